@@ -0,0 +1,103 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_BENCH_HH
+#define IVANP_BENCH_HH
+
+// Minimal benchmark harness
+//
+// Each benchmark is calibrated to run for at least min_time per sample,
+// then timed over nsamples samples. The reported figure is the fastest
+// sample, which is the most stable under background noise; the median
+// is printed next to it to show the spread.
+//
+// If BENCH_JSON=<file> is set, a JSON object per benchmark is appended
+// to that file, one per line:
+//   {"name":,"unit":,"ns":,"ns_median":,"rate":}
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+namespace ivanp { namespace bench {
+
+template <typename T>
+inline void do_not_optimize(const T& x) {
+  asm volatile("" : : "r,m"(x) : "memory");
+}
+inline void clobber() { asm volatile("" : : : "memory"); }
+
+struct result {
+  std::string name, unit;
+  double ns, ns_median; // per unit
+  inline double rate() const noexcept { return 1e9/ns; }
+};
+
+class runner {
+  using clock_type = std::chrono::steady_clock;
+  const char* filter;
+  std::ofstream json;
+
+public:
+  double min_time = 0.2; // seconds per sample
+  unsigned nsamples = 5;
+
+  runner(int argc, char* argv[]): filter(argc>1 ? argv[1] : nullptr) {
+    if (const char* name = std::getenv("BENCH_JSON"))
+      json.open(name,std::ios::app);
+    std::cout << std::left << std::setw(40) << "benchmark"
+              << std::right << std::setw(14) << "ns/unit"
+              << std::setw(14) << "median"
+              << std::setw(16) << "units/s" << "  unit" << std::endl;
+  }
+
+  // f(n) performs n repetitions, each processing units_per_rep units
+  template <typename F>
+  result operator()(
+    const std::string& name, const char* unit,
+    double units_per_rep, F&& f
+  ) {
+    result r { name, unit, 0, 0 };
+    if (filter && !strstr(name.c_str(),filter)) return r;
+
+    auto time = [&](long unsigned n){
+      const auto start = clock_type::now();
+      f(n);
+      clobber();
+      return std::chrono::duration<double>(clock_type::now()-start).count();
+    };
+
+    long unsigned n = 1;
+    for (double t; (t = time(n)) < min_time; ) {
+      n = t > 0 ? std::max<long unsigned>(n*2,n*(1.2*min_time/t)) : n*10;
+    }
+
+    std::vector<double> samples(nsamples);
+    for (auto& s : samples) s = time(n)*1e9/(n*units_per_rep);
+    std::sort(samples.begin(),samples.end());
+    r.ns = samples.front();
+    r.ns_median = samples[samples.size()/2];
+
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::fixed << std::setprecision(3)
+              << std::setw(14) << r.ns
+              << std::setw(14) << r.ns_median
+              << std::setprecision(0)
+              << std::setw(16) << r.rate() << "  " << unit << std::endl;
+    if (json.is_open())
+      json << std::setprecision(6) << std::defaultfloat
+           << "{\"name\":\"" << r.name << "\",\"unit\":\"" << r.unit
+           << "\",\"ns\":" << r.ns << ",\"ns_median\":" << r.ns_median
+           << ",\"rate\":" << r.rate() << "}\n";
+    return r;
+  }
+};
+
+}}
+
+#endif
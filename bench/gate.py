@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# Performance and numerical regression gate
+#
+#   bench/gate.py record [-b baseline.json]   run and store a baseline
+#   bench/gate.py check  [-b baseline.json]   run and compare to it
+#
+# Benchmarks run on synthetic samples from bin/gen with fixed seeds:
+#   angles : angles pass over an events tree
+#   fit    : fit.cc in mass bins, parameters and -2LogL from TF1s
+#   fit2   : fit2.cc in mass bins, parameters and -2LogL from JSON
+#   toys   : mc_test ensemble, parameters and -2LogL per toy
+# Results must agree within --rtol/--atol, and throughput may not drop
+# by more than --noise relative to the baseline.
+# Baselines are machine specific; record one per machine.
+
+import sys, os, re, json, time, shutil, socket, argparse, tempfile
+import subprocess as sp
+
+here = os.path.dirname(os.path.abspath(__file__))
+top = os.path.dirname(here)
+bin_dir = os.path.join(top,'bin')
+
+ap = argparse.ArgumentParser()
+ap.add_argument('mode', choices=['record','check'])
+ap.add_argument('-b','--baseline', default=os.path.join(here,'baseline.json'))
+ap.add_argument('-N','--nevents', type=int, default=1000000)
+ap.add_argument('--ntoys', type=int, default=5)
+ap.add_argument('--repeat', type=int, default=3,
+    help='runs per benchmark, the fastest is kept')
+ap.add_argument('--rtol', type=float, default=1e-6,
+    help='relative tolerance on -2LogL and chi2')
+ap.add_argument('--atol', type=float, default=1e-4,
+    help='absolute tolerance on fitted parameters')
+ap.add_argument('--noise', type=float, default=0.15,
+    help='allowed relative throughput loss')
+ap.add_argument('--only', nargs='*', help='run only these benchmarks')
+args = ap.parse_args()
+
+tmp = tempfile.mkdtemp(prefix='gate_')
+
+def run(*cmd):
+    log = os.path.join(tmp,'log')
+    with open(log,'w') as f:
+        t = time.perf_counter()
+        rc = sp.call([str(x) for x in cmd], stdout=f, stderr=sp.STDOUT)
+        t = time.perf_counter() - t
+    if rc:
+        sys.stdout.write(open(log).read())
+        raise RuntimeError('failed: '+' '.join(str(x) for x in cmd))
+    return t
+
+def timed(nevents, *cmd):
+    # fastest of several runs: least affected by background load
+    return nevents / min(run(*cmd) for _ in range(args.repeat))
+
+def gen(fmt, N, *opts):
+    name = os.path.join(tmp,'{}_{}.{}'.format(fmt,N,
+        'txt' if fmt=='text' else 'root'))
+    if not os.path.exists(name):
+        run(os.path.join(bin_dir,'gen'),'-f',fmt,'-N',N,'-o',name,
+            '--seed',1,'-m','200:600','-c','0.3:0.1:0:0.2',*opts)
+    return name
+
+def tf1_results(fname):
+    # parameters and -2LogL of the logl fits stored in TF1 titles
+    from ROOT import TFile, TH1, TF1
+    f = TFile(fname)
+    res = { }
+    def read(fun, key):
+        res[key] = {
+            'pars': [ fun.GetParameter(i) for i in range(fun.GetNpar()) ],
+            'logl': float(fun.GetTitle().split('=')[-1]) }
+    for k in f.GetListOfKeys():
+        obj = k.ReadObj()
+        if obj.InheritsFrom(TH1.Class()):
+            for fun in obj.GetListOfFunctions():
+                if '-logl' in fun.GetName():
+                    read(fun, re.search(r'\[.*\)',obj.GetName()).group(0))
+        elif obj.InheritsFrom(TF1.Class()) and '-logl' in obj.GetName():
+            read(obj, obj.GetName())
+    return res
+
+# Benchmarks =======================================================
+def bench_angles():
+    ifname = gen('events', args.nevents)
+    return {
+        'rate': timed(args.nevents, os.path.join(bin_dir,'angles'),
+            ifname,'-o',os.path.join(tmp,'angles.root'),'-m','200:600') }
+
+def bench_fit():
+    ifname = gen('angles', args.nevents)
+    ofname = os.path.join(tmp,'fit.root')
+    rate = timed(args.nevents, os.path.join(bin_dir,'fit'),
+        ifname,'-o',ofname,'-M','8:200:600','-n',4,'--nbins',50)
+    return { 'rate': rate, 'results': tf1_results(ofname) }
+
+def bench_fit2():
+    ifname = gen('t3', args.nevents)
+    cfname = os.path.join(tmp,'fit2.conf')
+    with open(cfname,'w') as f:
+        f.write('M 8 200 600\ncos 50 -1 1\n'
+                'p c2 0 0.01 -1 1\np c4 0 0.01 -1 1\n'
+                'p c6 0 0.01 -1 1\np phi2 0 0.01 -3.2 3.2\n')
+    ofname = os.path.join(tmp,'fit2.json')
+    rate = timed(args.nevents, os.path.join(bin_dir,'fit2'),
+        ifname,'-c',cfname,'-o',ofname,'--prec',17)
+    res = { }
+    for (lo, hi), fits, _ in json.load(open(ofname))[2]:
+        for name, fit in fits.items():
+            res['[{},{}) {}'.format(lo,hi,name)] = {
+                'pars': [ v[0] for k, v in fit.items()
+                          if k not in ('chi2','logl') ],
+                'logl': fit['logl'], 'chi2': fit['chi2'] }
+    return { 'rate': rate, 'results': res }
+
+def bench_toys():
+    N = args.nevents // 10
+    res = { }
+    t = 0
+    for seed in range(1,args.ntoys+1):
+        ofname = os.path.join(tmp,'toy.root')
+        t += min( run(os.path.join(bin_dir,'mc_test'),'-o',ofname,
+                      '-c','0.3:0.1:0:0.2','-N',N,'--seed',seed)
+                  for _ in range(args.repeat) )
+        for k, v in tf1_results(ofname).items():
+            res['seed {} {}'.format(seed,k)] = v
+    return { 'rate': N*args.ntoys/t, 'results': res }
+
+benchmarks = [
+    ('angles', bench_angles),
+    ('fit',    bench_fit),
+    ('fit2',   bench_fit2),
+    ('toys',   bench_toys),
+]
+
+# Comparison =======================================================
+def compare(name, new, old):
+    errs = [ ]
+    if new['rate'] < (1.-args.noise)*old['rate']:
+        errs.append('throughput {:.4g} events/s, baseline {:.4g} ({:+.1f}%)'
+            .format(new['rate'], old['rate'],
+                    100.*(new['rate']/old['rate']-1.)))
+    new_res, old_res = new.get('results',{}), old.get('results',{})
+    for key in sorted(set(new_res) | set(old_res)):
+        if key not in new_res or key not in old_res:
+            errs.append('{}: {}'.format(key,
+                'missing' if key in old_res else 'not in baseline'))
+            continue
+        a, b = new_res[key], old_res[key]
+        for q in ('logl','chi2'):
+            if q in b and abs(a[q]-b[q]) > args.rtol*max(abs(b[q]),1.):
+                errs.append('{} {}: {!r}, baseline {!r}'.format(key,q,a[q],b[q]))
+        for i, (x, y) in enumerate(zip(a['pars'],b['pars'])):
+            if abs(x-y) > args.atol:
+                errs.append('{} par {}: {!r}, baseline {!r}'.format(key,i,x,y))
+        if len(a['pars']) != len(b['pars']):
+            errs.append('{}: {} parameters, baseline {}'.format(
+                key, len(a['pars']), len(b['pars'])))
+    return errs
+
+# Main =============================================================
+try:
+    if args.mode == 'check':
+        if not os.path.exists(args.baseline):
+            sys.exit('no baseline {}, run "gate.py record" first'
+                     .format(args.baseline))
+        baseline = json.load(open(args.baseline))
+        print('Baseline: {} ({}, N = {})'.format(
+            args.baseline, baseline['host'], baseline['nevents']))
+        if baseline['nevents'] != args.nevents:
+            sys.exit('baseline was recorded with N = {}'.format(
+                baseline['nevents']))
+
+    results = { }
+    failed = False
+    for name, f in benchmarks:
+        if args.only and name not in args.only: continue
+        results[name] = res = f()
+        line = '{:8} {:14.4g} events/s'.format(name, res['rate'])
+        if args.mode == 'check':
+            if name not in baseline['benchmarks']:
+                print(line + '  (not in baseline)')
+                continue
+            old = baseline['benchmarks'][name]
+            line += '  {:+6.1f}%'.format(100.*(res['rate']/old['rate']-1.))
+            errs = compare(name, res, old)
+            print(line + ('  FAIL' if errs else '  OK'))
+            for e in errs: print('    ' + e)
+            failed = failed or bool(errs)
+        else:
+            print(line)
+
+    if args.mode == 'record':
+        with open(args.baseline,'w') as f:
+            json.dump({ 'host': socket.gethostname(),
+                        'nevents': args.nevents,
+                        'benchmarks': results }, f, indent=1, sort_keys=True)
+        print('Saved', args.baseline)
+    elif failed:
+        sys.exit('Regression gate FAILED')
+finally:
+    shutil.rmtree(tmp)
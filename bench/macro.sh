@@ -0,0 +1,37 @@
+#!/bin/bash
+# End-to-end benchmark: angles1 -> fit -> pars on synthetic events
+# Usage: bench/macro.sh [nevents=1000000] [seed=1]
+# Needs only the built executables; all inputs are generated here.
+
+nevents=${1:-1000000}
+seed=${2:-1}
+dir=$(mktemp -d)
+trap "rm -rf $dir" EXIT
+
+# time a command, print events/s and ns/event
+stage() {
+  local name=$1; shift
+  local t0=$(date +%s.%N)
+  "$@" > $dir/$name.log 2>&1 || { cat $dir/$name.log; exit 1; }
+  local t1=$(date +%s.%N)
+  awk -v n=$nevents -v a=$t0 -v b=$t1 -v s=$name 'BEGIN {
+    t = b-a
+    printf "%-10s %10.3f s %14.0f events/s %10.1f ns/event\n", s, t, n/t, 1e9*t/n
+  }'
+}
+
+printf "%d events, seed %d\n" $nevents $seed
+stage gen    ./bin/gen -f text -N $nevents --seed $seed -o $dir/events.dat \
+               -m 200:600 -c 0.3:0:0:0 -j 1
+stage angles ./bin/angles1 $dir/events.dat -o $dir/angles.root
+PROF_REPORT=$dir/fit.json \
+stage fit    ./bin/fit $dir/angles.root -o $dir/fits.root \
+               -M 8:200:600 -n 3 --nbins 50
+# likelihood evaluations from the fit profile report
+awk '/^"logl \[/ {
+    match($0,/"n":[0-9]+/);     n += substr($0,RSTART+4,RLENGTH-4)
+    match($0,/"s":[-+.e0-9]+/); t += substr($0,RSTART+4,RLENGTH-4)
+  }
+  END { if (t>0) printf "%-10s %10.3f s %14.1f evals/s\n", "logl", t, n/t }
+' $dir/fit.json
+stage pars   ./bin/pars $dir/fits.root -o $dir/pars.root
@@ -0,0 +1,249 @@
+// Microbenchmarks of the hot kernels
+// Usage: bin/bench_micro [name filter]
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+
+#include "bench.hh"
+#include "binner.hh"
+#include "binner_replicas.hh"
+#include "sparse_container.hh"
+#include "math.hh"
+#include "lorentz_vector.hh"
+#include "Legendre.hh"
+#include "kernels.hh"
+
+using std::cout;
+using std::endl;
+using namespace ivanp;
+using namespace ivanp::math;
+using ivanp::bench::do_not_optimize;
+
+struct lo_bin {
+  double w = 0, w2 = 0;
+  long unsigned n = 0;
+  inline void operator()(double weight) noexcept {
+    w  += weight;
+    w2 += weight*weight;
+    ++n;
+  }
+  inline lo_bin& operator+=(const lo_bin& b) noexcept {
+    w  += b.w;
+    w2 += b.w2;
+    n  += b.n;
+    return *this;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  bench::runner run(argc,argv);
+
+  std::mt19937 gen(42); // fixed seed: identical inputs for every run
+  std::uniform_real_distribution<double> cos_dist(-1.,1.), unit(0.,1.);
+
+  const unsigned n = 1<<12;
+  std::vector<double> x(n), w(n), m(n);
+  for (auto& a : x) a = cos_dist(gen);
+  for (auto& a : w) a = 0.5 + unit(gen);
+  for (auto& a : m) a = 200. + 400.*unit(gen);
+
+  const double c[4] = { 0.3, -0.1, 0.05, 0.2 };
+
+  // Legendre -------------------------------------------------------
+  run("Legendre","eval",n,[&](long unsigned k){
+    for (; k; --k) {
+      double s = 0;
+      for (unsigned i=0; i<n; ++i) s += Legendre(&x[i],c);
+      do_not_optimize(s);
+    }
+  });
+
+  // cos θ from 4-momenta -------------------------------------------
+  std::vector<lorentz_vector> pH(n), pj(n);
+  for (unsigned i=0; i<n; ++i) {
+    auto& h = pH[i];
+    auto& j = pj[i];
+    h.x = 100.*(unit(gen)-0.5); h.y = 100.*(unit(gen)-0.5);
+    h.z = 400.*(unit(gen)-0.5);
+    j.x = -h.x + 10.*(unit(gen)-0.5); j.y = -h.y + 10.*(unit(gen)-0.5);
+    j.z = 400.*(unit(gen)-0.5);
+    h.t = std::sqrt(sq(125.) + sq(h.x) + sq(h.y) + sq(h.z));
+    j.t = std::sqrt(sq(j.x) + sq(j.y) + sq(j.z));
+  }
+  run("cos_theta","event",n,[&](long unsigned k){
+    for (; k; --k) {
+      double s = 0;
+      for (unsigned i=0; i<n; ++i) {
+        const auto Q = pH[i] + pj[i];
+        const double Q2 = Q*Q;
+        const lorentz_vector Z {Q.z,0,0,Q.t};
+        const auto ell = ((Q*pj[i])/Q2)*pH[i] - ((Q*pH[i])/Q2)*pj[i];
+        s += (ell*Z) / std::sqrt(sq(ell)*sq(Z));
+      }
+      do_not_optimize(s);
+    }
+  });
+
+  { std::vector<double> soa[8], mass(n), cos(n);
+    const double* p[8];
+    for (unsigned k=0; k<8; ++k) {
+      soa[k].resize(n);
+      p[k] = soa[k].data();
+    }
+    for (unsigned i=0; i<n; ++i) {
+      soa[0][i] = pH[i].t; soa[1][i] = pH[i].x;
+      soa[2][i] = pH[i].y; soa[3][i] = pH[i].z;
+      soa[4][i] = pj[i].t; soa[5][i] = pj[i].x;
+      soa[6][i] = pj[i].y; soa[7][i] = pj[i].z;
+    }
+    run("cos_theta kernel","event",n,[&](long unsigned k){
+      for (; k; --k) {
+        kernels::cos_theta(p,n,mass.data(),cos.data());
+        do_not_optimize(cos[n-1]);
+      }
+    });
+
+    // every variant the CPU runs must match the generic one bitwise
+    using cos_theta_f = void(*)(const double* const*,size_t,double*,double*);
+    using logl_f = double(*)(const double*,const double*,size_t,
+      const kernels::legendre_pars&);
+    const cos_theta_f cos_theta_v[] = { kernels::cos_theta_generic,
+      kernels::cos_theta_sse42, kernels::cos_theta_avx2,
+      kernels::cos_theta_avx512 };
+    const logl_f logl_v[] = { kernels::logl_generic, kernels::logl_sse42,
+      kernels::logl_avx2, kernels::logl_avx512 };
+    const kernels::legendre_pars lp(c);
+    std::vector<double> mass0(n), cos0(n);
+    cos_theta_v[0](p,n,mass0.data(),cos0.data());
+    const double logl0 = logl_v[0](cos0.data(),w.data(),n,lp);
+    for (int v=1; v<=int(cpu::detect()); ++v) {
+      cos_theta_v[v](p,n,mass.data(),cos.data());
+      const double logl = logl_v[v](cos.data(),w.data(),n,lp);
+      if (memcmp(mass.data(),mass0.data(),n*sizeof(double))
+       || memcmp(cos.data(),cos0.data(),n*sizeof(double))
+       || memcmp(&logl,&logl0,sizeof(double))) {
+        std::cerr << cpu::str(cpu::isa(v))
+                  << " kernels differ from the generic ones" << endl;
+        return 1;
+      }
+    }
+  }
+
+  // binner fills ---------------------------------------------------
+  { binner<lo_bin, std::tuple<
+      axis_spec<uniform_axis<double>, false, false> >
+    > h({100u,-1.,1.});
+    run("binner uniform fill","event",n,[&](long unsigned k){
+      for (; k; --k) for (unsigned i=0; i<n; ++i) h(x[i],w[i]);
+    });
+    run("binner uniform fill_batch","event",n,[&](long unsigned k){
+      for (; k; --k) h.fill_batch(n,x.data(),w.data());
+    });
+    do_not_optimize(h.bins()[1].n);
+  }
+  { // threads filling replicas, as fit2 fills one per file
+    using hist = binner<lo_bin, std::tuple<
+      axis_spec<uniform_axis<double>, false, false> > >;
+    const unsigned nr = 8;
+    auto fill = [&](hist& h){
+      auto reps = make_replicas(h,nr);
+      #pragma omp parallel for schedule(static,1)
+      for (unsigned r=0; r<nr; ++r)
+        reps[r].fill_batch(n/nr,x.data()+r*(n/nr),w.data()+r*(n/nr));
+      reps.merge();
+    };
+    hist serial({100u,-1.,1.}), h({100u,-1.,1.});
+    serial.fill_batch(n,x.data(),w.data());
+    fill(h);
+    for (unsigned i=0; i<h.bins().size(); ++i) {
+      const auto &a = serial.bins()[i], &b = h.bins()[i];
+      if (a.n!=b.n || std::abs(a.w-b.w) > 1e-12*std::abs(a.w)) {
+        std::cerr << "binner replicas: bin " << i
+                  << " differs from the serial fill" << endl;
+        return 1;
+      }
+    }
+    run("binner replicas fill","event",n,[&](long unsigned k){
+      for (; k; --k) {
+        hist h({100u,-1.,1.});
+        fill(h);
+        do_not_optimize(h.bins()[1].n);
+      }
+    });
+  }
+  { // sparse running sums allocate only the bins they fill
+    using axes = std::tuple<
+      axis_spec<uniform_axis<double>>, axis_spec<uniform_axis<double>> >;
+    binner<lo_bin, axes> dense({50u,-1.,1.},{20u,200.,600.});
+    binner<lo_bin, axes, sparse_container<lo_bin>>
+      sparse({50u,-1.,1.},{20u,200.,600.});
+    dense.fill_batch(64,x.data(),m.data(),w.data());
+    sparse.fill_batch(64,x.data(),m.data(),w.data());
+    dense.integrate_right<0>();
+    sparse.integrate_right<0>();
+    dense.integrate_left<1>();
+    sparse.integrate_left<1>();
+    for (unsigned i=0; i<dense.bins().size(); ++i) {
+      const auto &a = dense.bins()[i], &b = sparse.bins().get(i);
+      if (a.n!=b.n || a.w!=b.w || a.w2!=b.w2 ||
+          (!a.n && sparse.bins().is_filled(i))) {
+        std::cerr << "sparse integrate: bin " << i
+                  << " differs from the dense one" << endl;
+        return 1;
+      }
+    }
+  }
+  { std::vector<double> edges { 200 };
+    while (edges.back() < 600) edges.push_back(edges.back()*1.05);
+    binner<lo_bin, std::tuple<
+      axis_spec<container_axis<std::vector<double>>, false, false> >
+    > h(edges);
+    binner<lo_bin, std::tuple<
+      axis_spec<indexed_axis<double>, false, false> >
+    > hi(make_indexed_axis(edges));
+
+    run("binner container fill","event",n,[&](long unsigned k){
+      for (; k; --k) for (unsigned i=0; i<n; ++i) h(m[i],w[i]);
+    });
+    run("binner indexed fill","event",n,[&](long unsigned k){
+      for (; k; --k) for (unsigned i=0; i<n; ++i) hi(m[i],w[i]);
+    });
+    do_not_optimize(h.bins()[1].n);
+    do_not_optimize(hi.bins()[1].n);
+  }
+
+  // unbinned likelihood, as in fit2 --------------------------------
+  for (unsigned N : {1000u, 10000u, 100000u, 1000000u}) {
+    std::vector<double> lx(N), lw(N);
+    for (auto& a : lx) a = cos_dist(gen);
+    for (auto& a : lw) a = 0.5 + unit(gen);
+
+    auto fLogL = [&x=lx,&w=lw](const double* c) -> double {
+      long double logl = 0.;
+      const unsigned n = x.size();
+      #pragma omp parallel for reduction(+:logl)
+      for (unsigned i=0; i<n; ++i)
+        logl += w[i]*log(Legendre(&x[i],c));
+      return -2.*logl;
+    };
+
+    const auto r = run(cat("logl N=",N),"event",N,[&](long unsigned k){
+      for (; k; --k) do_not_optimize(fLogL(c));
+    });
+    if (r.ns > 0)
+      cout << "  " << std::fixed << std::setprecision(1)
+           << r.rate()/N << " evals/s" << endl;
+
+    const auto rk = run(cat("logl kernel N=",N),"event",N,
+      [&](long unsigned k){
+        for (; k; --k) do_not_optimize(kernels::logl(
+          lx.data(),lw.data(),N,c));
+      });
+    if (rk.ns > 0)
+      cout << "  " << std::fixed << std::setprecision(1)
+           << rk.rate()/N << " evals/s" << endl;
+  }
+}
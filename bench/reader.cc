@@ -0,0 +1,90 @@
+// Benchmark of float_or_double_reader against plain TTreeReader access
+// Usage: bin/bench_reader [name filter]
+
+#include <iostream>
+#include <random>
+
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+#include <TTreeReaderArray.h>
+
+#include "bench.hh"
+#include "catstr.hh"
+#include "float_or_double_reader.hh"
+
+using namespace ivanp;
+using ivanp::bench::do_not_optimize;
+
+// in-memory ntuple with the same layout as the t3 input trees
+template <typename T>
+TTree* make_tree(const char* name, unsigned nent) {
+  TTree *t = new TTree(name,"");
+  t->SetDirectory(nullptr);
+  Int_t np;
+  T px[8], w;
+  t->Branch("nparticle",&np);
+  t->Branch("px",px,sizeof(T)==8 ? "px[nparticle]/D" : "px[nparticle]/F");
+  t->Branch("weight2",&w);
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<T> dist(-100,100);
+  for (unsigned i=0; i<nent; ++i) {
+    np = 2 + i%3;
+    for (int j=0; j<np; ++j) px[j] = dist(gen);
+    w = dist(gen);
+    t->Fill();
+  }
+  return t;
+}
+
+int main(int argc, char* argv[]) {
+  bench::runner run(argc,argv);
+  const unsigned nent = 1<<16;
+
+  TTree *td = make_tree<Double_t>("td",nent);
+  TTree *tf = make_tree<Float_t>("tf",nent);
+
+  for (TTree* t : {td,tf}) {
+    const char* type = (t==td ? "double" : "float");
+
+    run(cat("float_or_double_reader ",type),"event",nent,
+      [&](long unsigned k){
+        for (; k; --k) {
+          TTreeReader reader(t);
+          TTreeReaderValue<Int_t> _np(reader,"nparticle");
+          float_or_double_array_reader _px(reader,"px");
+          float_or_double_value_reader _w(reader,"weight2");
+          double s = 0;
+          while (reader.Next()) {
+            const int np = *_np;
+            for (int i=0; i<np; ++i) s += _px[i];
+            s += *_w;
+          }
+          do_not_optimize(s);
+        }
+      });
+
+    auto direct = [&](auto x){
+      using T = decltype(x);
+      run(cat("TTreeReaderArray ",type),"event",nent,
+        [&](long unsigned k){
+          for (; k; --k) {
+            TTreeReader reader(t);
+            TTreeReaderValue<Int_t> _np(reader,"nparticle");
+            TTreeReaderArray<T> _px(reader,"px");
+            TTreeReaderValue<T> _w(reader,"weight2");
+            double s = 0;
+            while (reader.Next()) {
+              const int np = *_np;
+              for (int i=0; i<np; ++i) s += _px[i];
+              s += *_w;
+            }
+            do_not_optimize(s);
+          }
+        });
+    };
+    if (t==td) direct(Double_t{});
+    else direct(Float_t{});
+  }
+}
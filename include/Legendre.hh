@@ -1,6 +1,9 @@
 #ifndef LEGENDRE_HH
 #define LEGENDRE_HH
 
+#include <cmath>
+#include <complex>
+
 #include "math.hh"
 
 // (Sum[c(k) LegendreP[k,x], {k, 0, 6, 2}])^2
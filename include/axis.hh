@@ -201,6 +201,132 @@ public:
 
 };
 
+// Indexed Axis =====================================================
+
+/*
+ * Non-uniform axis with a search structure built once on construction.
+ * find_bin returns the same bin as container_axis::find_bin.
+ *
+ * Edges are stored in Eytzinger (breadth-first) order, so the binary
+ * search is branchless and touches one cache line per level near the
+ * top of the tree. If ncells > 0, a uniform grid of ncells cells over
+ * [min,max) is also built, mapping every cell to the first bin it
+ * overlaps. The lookup then starts from that bin and only steps over
+ * the edges inside the cell.
+ */
+
+template <typename EdgeType, bool Virtual=false>
+class indexed_axis final: public basic_axis<EdgeType,Virtual> {
+public:
+  using base_type  = basic_axis<EdgeType,Virtual>;
+  using edge_type  = EdgeType;
+  using edge_ptype = edge_proxy<edge_type>;
+  using size_type  = ivanp::axis_size_type;
+
+private:
+  std::vector<edge_type> _edges, _tree;
+  std::vector<size_type> _rank, _hint;
+  double _hint_scale; // cells per unit, not truncated for integer edges
+
+  size_type build_tree(size_type i, size_type k) {
+    if (k < _tree.size()) {
+      i = build_tree(i,2*k);
+      _tree[k] = _edges[i];
+      _rank[k] = i;
+      i = build_tree(i+1,2*k+1);
+    }
+    return i;
+  }
+
+  void build(size_type ncells) {
+    const size_type n = _edges.size();
+    _tree.assign(n+1,edge_type{});
+    _rank.assign(n+1,n);
+    build_tree(0,1);
+
+    _hint.clear();
+    if (ncells && n>1) {
+      _hint.reserve(ncells);
+      _hint_scale = double(ncells)/double(max()-min());
+      const double width = double(max()-min())/ncells;
+      for (size_type c=0; c<ncells; ++c)
+        _hint.push_back(std::distance( _edges.begin(),
+          std::upper_bound(_edges.begin(), _edges.end(), min()+c*width) ));
+    }
+  }
+
+  template <typename T>
+  inline size_type find_bin_tree(const T& x) const noexcept {
+    const size_type n = _edges.size();
+    size_type k = 1;
+    while (k <= n) k = 2*k + !(x < _tree[k]);
+    k >>= __builtin_ffs(~k);
+    return _rank[k];
+  }
+
+  template <typename T>
+  inline size_type find_bin_hint(const T& x) const noexcept {
+    const size_type n = _edges.size();
+    if (x < _edges.front()) return 0;
+    if (!(x < _edges.back())) return n;
+    size_type c = double(x-_edges.front())*_hint_scale;
+    if (c >= _hint.size()) c = _hint.size()-1;
+    size_type i = _hint[c];
+    while (i && x < _edges[i-1]) --i; // guard against rounding of c
+    while (!(x < _edges[i])) ++i;
+    return i;
+  }
+
+public:
+  indexed_axis() = default;
+  ~indexed_axis() = default;
+
+  template <typename C,
+            std::enable_if_t<!std::is_same<C,indexed_axis>::value>* = nullptr>
+  indexed_axis(const C& edges, size_type ncells=0)
+  : _edges(std::begin(edges),std::end(edges)) { build(ncells); }
+  indexed_axis(std::initializer_list<edge_type> edges, size_type ncells=0)
+  : _edges(edges) { build(ncells); }
+
+  inline size_type nedges() const noexcept { return _edges.size(); }
+  inline size_type nbins () const noexcept { return _edges.size()-1; }
+
+  inline edge_type edge(size_type i) const noexcept { return _edges[i]; }
+
+  inline edge_type min() const noexcept { return _edges.front(); }
+  inline edge_type max() const noexcept { return _edges.back(); }
+
+  inline edge_ptype lower(size_type i) const noexcept {
+    edge_ptype proxy(
+      i==0 ? edge_ptype::minf :
+      i>nedges()+1 ? edge_ptype::pinf : edge_ptype::ok );
+    if (proxy) proxy = edge(i-1);
+    return proxy;
+  }
+  inline edge_ptype upper(size_type i) const noexcept {
+    edge_ptype proxy( i>=nedges() ? edge_ptype::pinf : edge_ptype::ok );
+    if (proxy) proxy = edge(i);
+    return proxy;
+  }
+
+  template <typename T>
+  inline size_type find_bin(const T& x) const noexcept {
+    return _hint.empty() ? find_bin_tree(x) : find_bin_hint(x);
+  }
+  inline size_type vfind_bin(edge_type x) const { return find_bin(x); }
+
+  template <typename T>
+  inline size_type operator[](const T& x) const noexcept {
+    return find_bin(x);
+  }
+
+  inline const std::vector<edge_type>& edges() const { return _edges; }
+  inline size_type ncells() const noexcept { return _hint.size(); }
+
+  constexpr bool is_uniform() const noexcept { return false; }
+
+};
+
 // Uniform Axis =====================================================
 
 template <typename EdgeType, bool Virtual=false>
@@ -269,6 +395,24 @@ public:
   inline size_type operator[](const T& x) const noexcept
   { return find_bin(x); }
 
+  // Same result as find_bin for each x[i], but without branches,
+  // so that the compiler can vectorize the loop
+  // (requires -fno-trapping-math)
+  template <typename T> [[ gnu::always_inline ]]
+  void find_bins(const T* __restrict__ x, size_type n,
+                 size_type* __restrict__ bins) const noexcept {
+    using float_type = decltype(x[0]-_min);
+    const edge_type min = _min, max = _max, range = _max - _min;
+    const float_type nb = _nbins;
+    for (size_type i=0; i<n; ++i) {
+      const T xi = x[i];
+      const bool under = xi < min, in = !under & (xi < max);
+      const float_type dx = in ? xi-min : float_type(0);
+      const float_type bin = nb*dx/range + 1;
+      bins[i] = (int)(in ? bin : (under ? float_type(0) : nb+1));
+    }
+  }
+
   constexpr bool is_uniform() const noexcept { return true; }
 
 };
@@ -405,6 +549,13 @@ inline auto make_axis(const std::array<T,N>& edges)
   return { edges };
 }
 
+template <typename C,
+          typename EdgeType = std::decay_t<decltype(*std::begin(std::declval<C>()))>>
+inline auto make_indexed_axis(const C& edges, axis_size_type ncells=0)
+-> indexed_axis<EdgeType> {
+  return { edges, ncells };
+}
+
 template <typename EdgeType>
 inline auto make_unique_axis(const basic_axis<EdgeType>* axis)
 -> ref_axis<EdgeType,std::unique_ptr<basic_axis<EdgeType>>>{
@@ -510,6 +661,17 @@ inline std::string bin_str(const Axis& a, axis_size_type i) {
   return cat('[',a.lower(i),',',a.upper(i),')');
 }
 
+template <typename Axis, typename T>
+inline void find_bins(const Axis& a, const T* x,
+  axis_size_type n, axis_size_type* bins
+) {
+  for (axis_size_type i=0; i<n; ++i) bins[i] = a.find_bin(x[i]);
+}
+template <typename E, bool V, typename T>
+inline void find_bins(const uniform_axis<E,V>& a, const T* x,
+  axis_size_type n, axis_size_type* bins
+) { a.find_bins(x,n,bins); }
+
 template <typename T, typename Axis>
 auto vector_of_edges(const Axis& axis) {
   const auto n = axis.nedges();
@@ -7,6 +7,7 @@
 #include <array>
 #include <vector>
 #include <iterator>
+#include <algorithm>
 #include <stdexcept>
 
 #include "axis.hh"
@@ -25,6 +26,44 @@ struct axis_spec {
   using excep = std::integral_constant<bool,Ex>;
 };
 
+// Add the bins of b to a, one by one
+template <typename C>
+inline void add_bins(C& a, const C& b) {
+  for (auto i=a.size(); i!=0;) {
+    --i;
+    a[i] += b[i];
+  }
+}
+
+// Running sums along an axis of n bins, with nb bins before it and na
+// after it in the index, starting from begin
+template <typename It>
+void integrate_bins_from(It begin,
+  axis_size_type nb, axis_size_type n, axis_size_type na
+) {
+  for (axis_size_type a=na; a; --a) {
+    for (axis_size_type b=nb; b;) { --b;
+      auto prev = begin;
+      for (axis_size_type i=n-1; i; --i) {
+        auto it = std::next(prev,nb);
+        *it += *prev;
+        prev = it;
+      }
+      if (b) ++begin;
+      else begin = std::next(prev);
+    }
+  }
+}
+
+// Running sums towards higher (right) or lower bin indices
+template <typename C>
+inline void integrate_bins(C& bins,
+  axis_size_type nb, axis_size_type n, axis_size_type na, bool right
+) {
+  if (right) integrate_bins_from(bins.begin(),nb,n,na);
+  else integrate_bins_from(bins.rbegin(),nb,n,na);
+}
+
 template <typename Bin,
           typename AxesSpecs = std::tuple<axis_spec<uniform_axis<double>>>,
           typename Container = std::vector<Bin>,
@@ -196,6 +235,33 @@ private:
     return bin;
   }
 
+  // batch fill -----------------------------------------------------
+  template <size_t I, typename Tup>
+  inline std::enable_if_t<(I<naxes)> find_bins_batch(
+    const Tup& ptrs, size_type first, size_type n,
+    size_type stride, size_type* idx, size_type* tmp
+  ) const {
+    find_bins(axis<I>(), std::get<I>(ptrs)+first, n, tmp);
+    for (size_type j=0; j<n; ++j) {
+      if (idx[j] == size_type(-1)) continue;
+      const size_type bin = tmp[j];
+      if (guard_under<I>(bin) || guard_over<I>(bin)) idx[j] = size_type(-1);
+      else idx[j] += (bin - !axis_spec<I>::under::value) * stride;
+    }
+    find_bins_batch<I+1>(ptrs, first, n, stride*nbins<I>(), idx, tmp);
+  }
+  template <size_t I, typename Tup>
+  inline std::enable_if_t<(I==naxes)> find_bins_batch(
+    const Tup&, size_type, size_type, size_type, size_type*, size_type*
+  ) const noexcept { }
+
+  template <typename Tup, size_t... I>
+  inline void fill_bin_batch(size_type bin,
+    const Tup& ptrs, size_type k, std::index_sequence<I...>
+  ) {
+    filler_type()(_bins[bin], std::get<I>(ptrs)[k]...);
+  }
+
   template <typename T, typename... TT>
   constexpr size_type index_impl(T i, TT... ii) const noexcept {
     return i + (axis<naxes-sizeof...(TT)-1>().nbins()
@@ -213,14 +279,14 @@ public:
   ~binner() = default;
 
   template <typename C=container_type,
-            std::enable_if_t<is_std_vector<C>::value>* = nullptr>
+            std::enable_if_t<!is_std_array<C>::value>* = nullptr>
   binner(typename Ax::axis... axes): _axes{axes...}, _bins(nbins_total()) { }
   template <typename C=container_type,
             std::enable_if_t<is_std_array<C>::value>* = nullptr>
   binner(typename Ax::axis... axes): _axes{axes...}, _bins{} { }
 
   template <typename Name, typename C=container_type,
-            std::enable_if_t<is_std_vector<C>::value>* = nullptr>
+            std::enable_if_t<!is_std_array<C>::value>* = nullptr>
   binner(Name&& name, typename Ax::axis... axes)
   : _axes{axes...}, _bins(nbins_total()) {
     all.emplace_back(this,std::forward<Name>(name));
@@ -236,7 +302,9 @@ public:
   : _axes(axes), _bins(std::forward<C>(bins)) { }
 
   binner(const binner& o): _axes(o._axes), _bins(o._bins) { }
-  binner(binner&& o): _axes(std::move(o._axes)), _bins(std::move(o._bins)) { }
+  binner(binner&& o) noexcept(
+    std::is_nothrow_move_constructible<container_type>::value)
+  : _axes(std::move(o._axes)), _bins(std::move(o._bins)) { }
   binner& operator=(const binner& rhs) {
     _axes = rhs._axes;
     _bins = rhs._bins;
@@ -255,10 +323,7 @@ public:
   binner& operator+=(const binner& rhs) {
     if (nbins_total() != rhs.nbins_total()) throw std::length_error(
       "binner::operator+=: nbins_total does not match");
-    for (size_type i=nbins_total(); i!=0;) {
-      --i;
-      _bins[i] += rhs._bins[i];
-    }
+    add_bins(_bins,rhs._bins);
     return *this;
   }
 
@@ -333,44 +398,37 @@ public:
     return fill(args...);
   }
 
-  // Algorithms -----------------------------------------------------
-  template <unsigned I=0> void integrate_right() {
-    const size_type nb = nbins_before<I>();
-    const size_type n  = nbins<I>()-1;
-    const size_type na = nbins_after<I>();
-
-    auto begin = _bins.begin();
-    for (size_type a=na; a; --a) {
-      for (size_type b=nb; b;) { --b;
-        auto prev = begin;
-        for (size_type i=n; i; --i) {
-          auto it = std::next(prev,nb);
-          *it += *prev;
-          prev = it;
-        }
-        if (b) ++begin;
-        else begin = std::next(prev);
+  // batch fill -----------------------------------------------------
+  // Fill n entries at once. The first naxes pointers are arrays of
+  // coordinates, the rest are arrays of arguments passed to the filler.
+  // Bin indices are computed a block at a time, with the strides
+  // precomputed, and then the bins are filled in a separate pass.
+  static constexpr size_type batch_size = 256;
+
+  template <typename... T>
+  void fill_batch(size_type n, const T*... ptrs) {
+    static_assert(sizeof...(T)>=naxes,"");
+    const auto tup = std::make_tuple(ptrs...);
+    size_type idx[batch_size], tmp[batch_size];
+    for (size_type first=0; first<n; first+=batch_size) {
+      const size_type m = std::min(batch_size,n-first);
+      std::fill_n(idx,m,0);
+      find_bins_batch<0>(tup, first, m, 1, idx, tmp);
+      for (size_type j=0; j<m; ++j) {
+        if (idx[j] == size_type(-1)) continue;
+        fill_bin_batch( idx[j], tup, first+j,
+          ivanp::seq::make_index_range<naxes,sizeof...(T)>() );
       }
     }
   }
+
+  // Algorithms -----------------------------------------------------
+  // found by ADL, for containers with their own integrate_bins
+  template <unsigned I=0> void integrate_right() {
+    integrate_bins(_bins,nbins_before<I>(),nbins<I>(),nbins_after<I>(),true);
+  }
   template <unsigned I=0> void integrate_left() {
-    const size_type nb = nbins_before<I>();
-    const size_type n  = nbins<I>()-1;
-    const size_type na = nbins_after<I>();
-
-    auto begin = _bins.rbegin();
-    for (size_type a=na; a; --a) {
-      for (size_type b=nb; b;) { --b;
-        auto prev = begin;
-        for (size_type i=n; i; --i) {
-          auto it = std::next(prev,nb);
-          *it += *prev;
-          prev = it;
-        }
-        if (b) ++begin;
-        else begin = std::next(prev);
-      }
-    }
+    integrate_bins(_bins,nbins_before<I>(),nbins<I>(),nbins_after<I>(),false);
   }
 };
 
@@ -378,6 +436,9 @@ template <typename B, typename... A, typename C, typename F>
 std::vector<typename binner<B,std::tuple<A...>,C,F>::named_ptr_type>
 binner<B,std::tuple<A...>,C,F>::all;
 
+template <typename B, typename... A, typename C, typename F>
+constexpr axis_size_type binner<B,std::tuple<A...>,C,F>::batch_size;
+
 // ##################################################################
 
 // Metafunctions
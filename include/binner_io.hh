@@ -0,0 +1,475 @@
+#ifndef IVANP_BINNER_IO_HH
+#define IVANP_BINNER_IO_HH
+
+// Binary snapshots of binners
+//
+// Format: native byte order, no padding between fields.
+// Trivially copyable types are written as raw bytes,
+// vectors and strings are prefixed by their size.
+// Bin types that are not trivially copyable need serialize/deserialize
+// overloads findable by ADL, e.g. in the namespace of the bin.
+// Include category_bin.hh and sparse_container.hh before this header
+// to enable their overloads.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <tuple>
+#include <cstring>
+#include <type_traits>
+
+#include "binner.hh"
+#include "error.hh"
+
+namespace ivanp { namespace io {
+
+constexpr char snapshot_magic[8] = { 'I','V','A','N','P','B','N','R' };
+constexpr unsigned snapshot_version = 1;
+
+// declarations =====================================================
+
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+serialize(std::ostream& os, const T& x);
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+deserialize(std::istream& is, T& x);
+
+void serialize(std::ostream& os, const std::string& x);
+void deserialize(std::istream& is, std::string& x);
+
+template <typename T, typename A>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+serialize(std::ostream& os, const std::vector<T,A>& x);
+template <typename T, typename A>
+std::enable_if_t<!std::is_trivially_copyable<T>::value>
+serialize(std::ostream& os, const std::vector<T,A>& x);
+template <typename T, typename A>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+deserialize(std::istream& is, std::vector<T,A>& x);
+template <typename T, typename A>
+std::enable_if_t<!std::is_trivially_copyable<T>::value>
+deserialize(std::istream& is, std::vector<T,A>& x);
+
+template <typename T, size_t N>
+std::enable_if_t<!std::is_trivially_copyable<std::array<T,N>>::value>
+serialize(std::ostream& os, const std::array<T,N>& x);
+template <typename T, size_t N>
+std::enable_if_t<!std::is_trivially_copyable<std::array<T,N>>::value>
+deserialize(std::istream& is, std::array<T,N>& x);
+
+template <typename... T>
+void serialize(std::ostream& os, const std::tuple<T...>& x);
+template <typename... T>
+void deserialize(std::istream& is, std::tuple<T...>& x);
+
+template <typename E, bool V>
+void serialize(std::ostream& os, const uniform_axis<E,V>& a);
+template <typename E, bool V>
+void deserialize(std::istream& is, uniform_axis<E,V>& a);
+template <typename E, bool V>
+void serialize(std::ostream& os, const index_axis<E,V>& a);
+template <typename E, bool V>
+void deserialize(std::istream& is, index_axis<E,V>& a);
+template <typename C, bool V>
+void serialize(std::ostream& os, const container_axis<C,V>& a);
+template <typename C, bool V>
+void deserialize(std::istream& is, container_axis<C,V>& a);
+template <typename E, bool V>
+void serialize(std::ostream& os, const indexed_axis<E,V>& a);
+template <typename E, bool V>
+void deserialize(std::istream& is, indexed_axis<E,V>& a);
+
+#ifdef CATEGORY_BIN_HH
+template <typename B, typename... E>
+void serialize(std::ostream& os, const category_bin<B,E...>& x);
+template <typename B, typename... E>
+void deserialize(std::istream& is, category_bin<B,E...>& x);
+#endif
+
+#ifdef IVANP_SPARSE_CONTAINER_HH
+template <typename B>
+void serialize(std::ostream& os, const sparse_container<B>& x);
+template <typename B>
+void deserialize(std::istream& is, sparse_container<B>& x);
+#endif
+
+template <typename B, typename... A, typename C, typename F>
+void serialize(std::ostream& os, const binner<B,std::tuple<A...>,C,F>& b);
+template <typename B, typename... A, typename C, typename F>
+void deserialize(std::istream& is, binner<B,std::tuple<A...>,C,F>& b);
+
+// basic types ======================================================
+
+inline void check(std::istream& is) {
+  if (!is) throw error("binner_io: unexpected end of snapshot");
+}
+
+// Sizes read from a snapshot are checked against the rest of the stream
+// before allocating, so that a corrupt one fails cleanly.
+// Streams that cannot seek are not checked.
+inline void check_size(std::istream& is, uint64_t n, size_t elem_size) {
+  const std::streamoff pos = is.tellg();
+  if (pos < 0) return;
+  is.seekg(0,std::ios::end);
+  const std::streamoff left = std::streamoff(is.tellg()) - pos;
+  is.seekg(pos);
+  if (left >= 0 && n > uint64_t(left)/elem_size) throw error(
+    "binner_io: size ",n," exceeds the snapshot");
+}
+
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+serialize(std::ostream& os, const T& x) {
+  os.write(reinterpret_cast<const char*>(&x),sizeof(T));
+}
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+deserialize(std::istream& is, T& x) {
+  is.read(reinterpret_cast<char*>(&x),sizeof(T));
+  check(is);
+}
+
+inline void serialize(std::ostream& os, const std::string& x) {
+  serialize(os,uint64_t(x.size()));
+  os.write(x.data(),x.size());
+}
+inline void deserialize(std::istream& is, std::string& x) {
+  uint64_t n;
+  deserialize(is,n);
+  check_size(is,n,1);
+  x.resize(n);
+  is.read(&x[0],n);
+  check(is);
+}
+
+template <typename T, typename A>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+serialize(std::ostream& os, const std::vector<T,A>& x) {
+  serialize(os,uint64_t(x.size()));
+  os.write(reinterpret_cast<const char*>(x.data()),x.size()*sizeof(T));
+}
+template <typename T, typename A>
+std::enable_if_t<!std::is_trivially_copyable<T>::value>
+serialize(std::ostream& os, const std::vector<T,A>& x) {
+  serialize(os,uint64_t(x.size()));
+  for (const auto& e : x) serialize(os,e);
+}
+template <typename T, typename A>
+std::enable_if_t<std::is_trivially_copyable<T>::value>
+deserialize(std::istream& is, std::vector<T,A>& x) {
+  uint64_t n;
+  deserialize(is,n);
+  check_size(is,n,sizeof(T));
+  x.resize(n);
+  is.read(reinterpret_cast<char*>(x.data()),n*sizeof(T));
+  check(is);
+}
+template <typename T, typename A>
+std::enable_if_t<!std::is_trivially_copyable<T>::value>
+deserialize(std::istream& is, std::vector<T,A>& x) {
+  uint64_t n;
+  deserialize(is,n);
+  check_size(is,n,1); // elements take at least a byte
+  x.resize(n);
+  for (auto& e : x) deserialize(is,e);
+}
+
+template <typename T, size_t N>
+std::enable_if_t<!std::is_trivially_copyable<std::array<T,N>>::value>
+serialize(std::ostream& os, const std::array<T,N>& x) {
+  for (const auto& e : x) serialize(os,e);
+}
+template <typename T, size_t N>
+std::enable_if_t<!std::is_trivially_copyable<std::array<T,N>>::value>
+deserialize(std::istream& is, std::array<T,N>& x) {
+  for (auto& e : x) deserialize(is,e);
+}
+
+template <typename... T, size_t... I>
+inline void serialize_tuple(std::ostream& os,
+  const std::tuple<T...>& x, std::index_sequence<I...>
+) {
+  using expander = int[];
+  (void)expander{0, ((void)serialize(os,std::get<I>(x)), 0)...};
+}
+template <typename... T, size_t... I>
+inline void deserialize_tuple(std::istream& is,
+  std::tuple<T...>& x, std::index_sequence<I...>
+) {
+  using expander = int[];
+  (void)expander{0, ((void)deserialize(is,std::get<I>(x)), 0)...};
+}
+template <typename... T>
+void serialize(std::ostream& os, const std::tuple<T...>& x) {
+  serialize_tuple(os,x,std::index_sequence_for<T...>());
+}
+template <typename... T>
+void deserialize(std::istream& is, std::tuple<T...>& x) {
+  deserialize_tuple(is,x,std::index_sequence_for<T...>());
+}
+
+// axes =============================================================
+
+inline void check_tag(std::istream& is, char tag) {
+  char t;
+  deserialize(is,t);
+  if (t!=tag) throw error("binner_io: expected axis type \'",tag,
+    "\', found \'",t,'\'');
+}
+
+template <typename E, bool V>
+void serialize(std::ostream& os, const uniform_axis<E,V>& a) {
+  serialize(os,'u');
+  serialize(os,a.nbins());
+  serialize(os,a.min());
+  serialize(os,a.max());
+}
+template <typename E, bool V>
+void deserialize(std::istream& is, uniform_axis<E,V>& a) {
+  check_tag(is,'u');
+  axis_size_type n;
+  E min, max;
+  deserialize(is,n);
+  deserialize(is,min);
+  deserialize(is,max);
+  a = uniform_axis<E,V>(n,min,max);
+}
+
+template <typename E, bool V>
+void serialize(std::ostream& os, const index_axis<E,V>& a) {
+  serialize(os,'x');
+  serialize(os,a.min());
+  serialize(os,a.max());
+}
+template <typename E, bool V>
+void deserialize(std::istream& is, index_axis<E,V>& a) {
+  check_tag(is,'x');
+  E min, max;
+  deserialize(is,min);
+  deserialize(is,max);
+  a = index_axis<E,V>(min,max);
+}
+
+template <typename C, typename E>
+inline std::enable_if_t<!is_std_array<C>::value,C>
+make_edges(const std::vector<E>& edges) {
+  return C(edges.begin(),edges.end());
+}
+template <typename C, typename E>
+inline std::enable_if_t<is_std_array<C>::value,C>
+make_edges(const std::vector<E>& edges) {
+  C c;
+  if (edges.size()!=c.size()) throw error(
+    "binner_io: expected ",c.size()," edges, found ",edges.size());
+  std::copy(edges.begin(),edges.end(),c.begin());
+  return c;
+}
+
+template <typename C, bool V>
+void serialize(std::ostream& os, const container_axis<C,V>& a) {
+  serialize(os,'c');
+  serialize(os,vector_of_edges<typename container_axis<C,V>::edge_type>(a));
+}
+template <typename C, bool V>
+void deserialize(std::istream& is, container_axis<C,V>& a) {
+  check_tag(is,'c');
+  std::vector<typename container_axis<C,V>::edge_type> edges;
+  deserialize(is,edges);
+  a = make_edges<C>(edges);
+}
+
+template <typename E, bool V>
+void serialize(std::ostream& os, const indexed_axis<E,V>& a) {
+  serialize(os,'i');
+  serialize(os,a.edges());
+  serialize(os,a.ncells());
+}
+template <typename E, bool V>
+void deserialize(std::istream& is, indexed_axis<E,V>& a) {
+  check_tag(is,'i');
+  std::vector<E> edges;
+  axis_size_type ncells;
+  deserialize(is,edges);
+  deserialize(is,ncells);
+  a = indexed_axis<E,V>(edges,ncells);
+}
+
+// bins and containers ==============================================
+
+#ifdef CATEGORY_BIN_HH
+template <typename B, typename... E>
+void serialize(std::ostream& os, const category_bin<B,E...>& x) {
+  serialize(os,x.bins);
+}
+template <typename B, typename... E>
+void deserialize(std::istream& is, category_bin<B,E...>& x) {
+  deserialize(is,x.bins);
+}
+#endif
+
+#ifdef IVANP_SPARSE_CONTAINER_HH
+template <typename B>
+void serialize(std::ostream& os, const sparse_container<B>& x) {
+  serialize(os,x.size());
+  serialize(os,uint64_t(x.nfilled()));
+  for (const auto& b : x.filled()) {
+    serialize(os,std::get<0>(b));
+    serialize(os,*std::get<1>(b));
+  }
+}
+template <typename B>
+void deserialize(std::istream& is, sparse_container<B>& x) {
+  axis_size_type size, i;
+  uint64_t n;
+  deserialize(is,size);
+  deserialize(is,n);
+  check_size(is,n,sizeof(i));
+  if (n > size) throw error(
+    "binner_io: ",n," filled bins in a container of ",size);
+  x = sparse_container<B>(size);
+  while (n--) {
+    deserialize(is,i);
+    if (i >= size) throw error(
+      "binner_io: bin ",i," in a container of ",size);
+    deserialize(is,x[i]);
+  }
+}
+#endif
+
+// binner ===========================================================
+
+template <typename B, typename... A, typename C, typename F>
+void serialize(std::ostream& os, const binner<B,std::tuple<A...>,C,F>& b) {
+  serialize(os,axis_size_type(sizeof...(A)));
+  serialize(os,b.axes());
+  serialize(os,b.bins());
+}
+template <typename B, typename... A, typename C, typename F>
+void deserialize(std::istream& is, binner<B,std::tuple<A...>,C,F>& b) {
+  axis_size_type naxes;
+  deserialize(is,naxes);
+  if (naxes!=sizeof...(A)) throw error(
+    "binner_io: expected ",sizeof...(A)," axes, found ",naxes);
+  typename binner<B,std::tuple<A...>,C,F>::axes_tuple axes;
+  C bins;
+  deserialize(is,axes);
+  deserialize(is,bins);
+  b = binner<B,std::tuple<A...>,C,F>(axes,std::move(bins));
+}
+
+template <typename A1, typename A2>
+bool same_axis(const A1& a, const A2& b) {
+  const auto n = a.nedges();
+  if (n!=b.nedges()) return false;
+  for (typename A1::size_type i=0; i<n; ++i)
+    if (a.edge(i)!=b.edge(i)) return false;
+  return true;
+}
+template <typename... A, size_t... I>
+inline bool same_axes(const std::tuple<A...>& a, const std::tuple<A...>& b,
+  std::index_sequence<I...>
+) {
+  bool same = true;
+  using expander = int[];
+  (void)expander{0, ((void)(same = same &&
+    same_axis(std::get<I>(a),std::get<I>(b))), 0)...};
+  return same;
+}
+
+// merge ============================================================
+
+template <typename T>
+inline void merge(T& a, const T& b) { a += b; }
+
+template <typename B, typename... A, typename C, typename F>
+void merge(
+  binner<B,std::tuple<A...>,C,F>& a, const binner<B,std::tuple<A...>,C,F>& b
+) {
+  if (!same_axes(a.axes(),b.axes(),std::index_sequence_for<A...>()))
+    throw error("binner_io: cannot merge binners with different axes");
+  a += b;
+}
+
+// snapshots ========================================================
+
+// A snapshot is the magic string and version followed by any number of
+// objects. Objects are read back in the same order as written.
+
+template <typename... T>
+void write_snapshot(std::ostream& os, const T&... xs) {
+  os.write(snapshot_magic,sizeof(snapshot_magic));
+  serialize(os,snapshot_version);
+  using expander = int[];
+  (void)expander{0, ((void)serialize(os,xs), 0)...};
+  if (!os) throw error("binner_io: failed to write snapshot");
+}
+
+inline void read_snapshot_header(std::istream& is) {
+  char magic[sizeof(snapshot_magic)];
+  unsigned version;
+  is.read(magic,sizeof(magic));
+  check(is);
+  if (memcmp(magic,snapshot_magic,sizeof(magic)))
+    throw error("binner_io: not a binner snapshot");
+  deserialize(is,version);
+  if (version!=snapshot_version) throw error(
+    "binner_io: snapshot version ",version,", expected ",snapshot_version);
+}
+
+template <typename... T>
+void read_snapshot(std::istream& is, T&... xs) {
+  read_snapshot_header(is);
+  using expander = int[];
+  (void)expander{0, ((void)deserialize(is,xs), 0)...};
+}
+
+// Read a snapshot and add its objects to xs
+template <typename... T>
+void merge_snapshot(std::istream& is, T&... xs) {
+  read_snapshot_header(is);
+  auto read_merge = [&is](auto& x) {
+    std::decay_t<decltype(x)> tmp;
+    deserialize(is,tmp);
+    merge(x,tmp);
+  };
+  using expander = int[];
+  (void)expander{0, ((void)read_merge(xs), 0)...};
+}
+
+// Registry of named binners ========================================
+
+template <typename Binner>
+void serialize_all(std::ostream& os) {
+  serialize(os,uint64_t(Binner::all.size()));
+  for (const auto& b : Binner::all) {
+    serialize(os,b.name);
+    serialize(os,*b);
+  }
+}
+
+// Add binners from the stream to the registered binners with same names
+template <typename Binner>
+void merge_all(std::istream& is) {
+  uint64_t n;
+  deserialize(is,n);
+  std::string name;
+  Binner tmp;
+  while (n--) {
+    deserialize(is,name);
+    deserialize(is,tmp);
+    bool found = false;
+    for (auto& b : Binner::all) {
+      if (b.name != name) continue;
+      merge(*b,tmp);
+      found = true;
+      break;
+    }
+    if (!found) throw error("binner_io: no registered binner ",name);
+  }
+}
+
+}} // end namespace ivanp::io
+
+#endif
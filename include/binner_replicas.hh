@@ -0,0 +1,66 @@
+#ifndef IVANP_BINNER_REPLICAS_HH
+#define IVANP_BINNER_REPLICAS_HH
+
+#include <vector>
+
+#include "binner.hh"
+
+namespace ivanp {
+
+// Copies of a binner for lock-free parallel filling.
+// Each thread fills only its own replicas. merge() adds the replicas
+// to the original binner with binner::operator+=, in replica order,
+// so the result does not depend on thread scheduling. Each replica is
+// freed once added.
+
+template <typename C>
+inline std::enable_if_t<!is_std_array<C>::value,C>
+make_bins(axis_size_type n) { return C(n); }
+template <typename C>
+inline std::enable_if_t<is_std_array<C>::value,C>
+make_bins(axis_size_type) { return C{}; }
+
+template <typename Binner>
+class binner_replicas {
+public:
+  using binner_type = Binner;
+  using container_type = typename binner_type::container_type;
+
+private:
+  binner_type& _orig;
+  std::vector<binner_type> _reps;
+
+public:
+  binner_replicas(binner_type& orig, unsigned n): _orig(orig) {
+    _reps.reserve(n);
+    for (unsigned i=0; i<n; ++i)
+      _reps.emplace_back( orig.axes(),
+        make_bins<container_type>(orig.nbins_total()) );
+  }
+
+  inline binner_type& operator[](unsigned i) noexcept { return _reps[i]; }
+  inline const binner_type& operator[](unsigned i) const noexcept
+  { return _reps[i]; }
+  inline unsigned size() const noexcept { return _reps.size(); }
+
+  inline auto begin() noexcept { return _reps.begin(); }
+  inline auto   end() noexcept { return _reps.  end(); }
+
+  binner_type& merge() {
+    for (auto& r : _reps) {
+      _orig += r;
+      r = binner_type();
+    }
+    _reps.clear();
+    return _orig;
+  }
+};
+
+template <typename Binner>
+inline binner_replicas<Binner> make_replicas(Binner& orig, unsigned n) {
+  return { orig, n };
+}
+
+} // end namespace ivanp
+
+#endif
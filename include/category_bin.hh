@@ -27,6 +27,13 @@ struct category_bin {
     if (_id) bins[_id](w);
     return *this;
   }
+  // thread-safe fill: category passed with each call instead of static _id
+  template <typename... Args>
+  inline category_bin& operator()(category c, const Args&... args) {
+    std::get<0>(bins)(args...);
+    if (const unsigned i = static_cast<unsigned>(c)) bins[i](args...);
+    return *this;
+  }
   inline category_bin& operator+=(const category_bin& b) noexcept {
     for (auto i=bins.size(); i; ) --i, bins[i] += b.bins[i];
     return *this;
@@ -0,0 +1,288 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_COLUMN_STORE_HH
+#define IVANP_COLUMN_STORE_HH
+
+// Event columns of one bin, moved to disk above a memory budget
+//
+// Rows are appended in memory. When the stores sharing a spill_budget
+// together hold more than its limit, the store being filled appends
+// its columns to files <dir>/spill<pid>_<id>.<column> and continues with
+// empty buffers. finish() writes out the rest and maps the files, so
+// that the likelihood kernel streams a spilled bin from the page cache
+// with sequential read-ahead, and gives the same sums as in memory.
+// Without a budget a store is a set of vectors.
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <new>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.hh"
+
+namespace ivanp {
+
+struct spill_budget {
+  std::string dir;
+  size_t limit; // bytes
+  std::atomic<size_t> used { 0 };
+  std::atomic<unsigned> next_id { 0 };
+
+  spill_budget(const std::string& dir, size_t limit)
+  : dir(dir), limit(limit) { mkdir(dir.c_str(),0755); }
+
+  // files of forked processes have their own names
+  std::string next_name() {
+    return dir+"/spill"+std::to_string(getpid())+'_'+std::to_string(next_id++);
+  }
+};
+
+// A budget in anonymous shared memory, kept by the processes forked
+// after it is made, so that their stores together keep to the limit
+inline std::shared_ptr<spill_budget> make_shared_budget(
+  const std::string& dir, size_t limit
+) {
+  void* p = mmap(nullptr,sizeof(spill_budget),PROT_READ|PROT_WRITE,
+                 MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if (p==MAP_FAILED) throw error("mmap spill budget: ",strerror(errno));
+  return { new(p) spill_budget(dir,limit), [](spill_budget* b){
+    b->~spill_budget();
+    munmap(b,sizeof(spill_budget));
+  } };
+}
+
+class column_store {
+  static constexpr size_t check_stride = 1<<12; // rows between checks
+
+  spill_budget* budget = nullptr;
+  std::vector<std::vector<double>> cols;
+  size_t n_disk = 0; // rows in files
+  size_t accounted = 0; // bytes counted in the budget
+  std::string name; // file name prefix, empty until spilled
+  std::vector<std::pair<void*,size_t>> maps;
+
+  void account() {
+    if (!budget) return;
+    const size_t bytes = cols.empty() ? 0 : cols[0].size()*cols.size()*8;
+    budget->used += bytes;
+    budget->used -= accounted;
+    accounted = bytes;
+    if (budget->used > budget->limit && bytes) spill();
+  }
+
+  std::string file(unsigned k) const { return name+'.'+std::to_string(k); }
+
+  void unmap() noexcept {
+    for (auto& m : maps) munmap(m.first,m.second);
+    maps.clear();
+  }
+
+  // unmap, give back the budget and remove the files
+  void release() noexcept {
+    unmap();
+    if (budget) budget->used -= accounted;
+    accounted = 0;
+    if (!name.empty())
+      for (unsigned k=0; k<cols.size(); ++k) std::remove(file(k).c_str());
+    name.clear();
+    n_disk = 0;
+  }
+
+public:
+  column_store(unsigned ncol = 0, spill_budget* budget = nullptr)
+  : budget(budget), cols(ncol) { }
+  column_store(const column_store&) = delete;
+  column_store& operator=(const column_store&) = delete;
+  column_store(column_store&& r) noexcept
+  : budget(r.budget), cols(std::move(r.cols)), n_disk(r.n_disk),
+    accounted(r.accounted), name(std::move(r.name)), maps(std::move(r.maps))
+  {
+    r.n_disk = 0;
+    r.accounted = 0;
+    r.name.clear();
+  }
+  column_store& operator=(column_store&& r) noexcept {
+    if (this != &r) {
+      release();
+      budget = r.budget;
+      cols = std::move(r.cols);
+      n_disk = r.n_disk;
+      accounted = r.accounted;
+      name = std::move(r.name);
+      maps = std::move(r.maps);
+      r.n_disk = 0;
+      r.accounted = 0;
+      r.name.clear();
+    }
+    return *this;
+  }
+  ~column_store() { release(); }
+
+  inline unsigned ncol() const noexcept { return cols.size(); }
+  inline size_t size() const noexcept {
+    return n_disk + (cols.empty() ? 0 : cols[0].size());
+  }
+  inline bool spilled() const noexcept { return n_disk; }
+
+  // set the number of columns of an empty store
+  void columns(unsigned ncol) {
+    if (size()) throw error("column_store: columns of a filled store");
+    cols.resize(ncol);
+  }
+
+  void reserve(size_t n) { for (auto& c : cols) c.reserve(n); }
+
+  inline void push(const double* row) {
+    for (unsigned k=0, n=cols.size(); k<n; ++k) cols[k].push_back(row[k]);
+    if (budget && cols[0].size() % check_stride == 0) account();
+  }
+
+  // n rows, column k starting at c[k]
+  void append(const double* const* c, size_t n) {
+    for (unsigned k=0; k<cols.size(); ++k)
+      cols[k].insert(cols[k].end(),c[k],c[k]+n);
+    account();
+  }
+
+  // Call f(c,n) for all the rows in order, in chunks of n rows,
+  // with column k of the chunk starting at c[k]
+  template <typename F>
+  void for_chunks(F&& f) const {
+    constexpr size_t chunk = 1<<16;
+    const unsigned nc = ncol();
+    std::vector<const double*> c(nc);
+    if (n_disk) { // stream the spilled rows
+      std::vector<std::ifstream> fs;
+      for (unsigned k=0; k<nc; ++k) fs.emplace_back(file(k),std::ios::binary);
+      std::vector<std::vector<double>> buf(nc,std::vector<double>(chunk));
+      for (size_t i=0; i<n_disk; i+=chunk) {
+        const size_t n = std::min(chunk,n_disk-i);
+        for (unsigned k=0; k<nc; ++k) {
+          fs[k].read(reinterpret_cast<char*>(buf[k].data()),n*8);
+          if (!fs[k]) throw error("column_store: cannot read ",file(k));
+          c[k] = buf[k].data();
+        }
+        f(c.data(),n);
+      }
+    }
+    const size_t n = nc ? cols[0].size() : 0;
+    for (size_t i=0; i<n; i+=chunk) {
+      for (unsigned k=0; k<nc; ++k) c[k] = cols[k].data()+i;
+      f(c.data(),std::min(chunk,n-i));
+    }
+  }
+
+  // rows of another store, in order
+  void append(const column_store& b) {
+    if (!b.size()) return;
+    if (cols.empty()) cols.resize(b.ncol());
+    else if (b.ncol()!=ncol())
+      throw error("column_store: appending different columns");
+    b.for_chunks([this](const double* const* c, size_t n){ append(c,n); });
+  }
+
+  // Number of columns and rows, then chunks of 1<<16 rows (the last
+  // may be shorter), each column by column
+  void write(std::ostream& os) const {
+    constexpr size_t chunk = 1<<16;
+    const unsigned nc = ncol();
+    const uint64_t head[2] = { nc, size() };
+    os.write(reinterpret_cast<const char*>(head),sizeof(head));
+    std::vector<std::vector<double>> buf(nc);
+    for (auto& b : buf) b.reserve(chunk);
+    auto flush = [&]{
+      for (auto& b : buf) {
+        os.write(reinterpret_cast<const char*>(b.data()),b.size()*8);
+        b.clear();
+      }
+    };
+    for_chunks([&](const double* const* c, size_t n){
+      for (size_t i=0; i<n; ) {
+        const size_t m = std::min(n-i,chunk-buf[0].size());
+        for (unsigned k=0; k<nc; ++k)
+          buf[k].insert(buf[k].end(),c[k]+i,c[k]+i+m);
+        i += m;
+        if (buf[0].size()==chunk) flush();
+      }
+    });
+    if (nc) flush();
+  }
+  // Append rows written by write()
+  void read(std::istream& is) {
+    uint64_t head[2];
+    is.read(reinterpret_cast<char*>(head),sizeof(head));
+    if (!is) throw error("column_store: unexpected end of input");
+    if (!size()) cols.resize(head[0]);
+    else if (head[0]!=ncol())
+      throw error("column_store: reading different columns");
+    constexpr size_t chunk = 1<<16;
+    std::vector<std::vector<double>> buf(ncol(),std::vector<double>(chunk));
+    std::vector<const double*> c(ncol());
+    for (size_t i=0; i<head[1]; i+=chunk) {
+      const size_t n = std::min<size_t>(chunk,head[1]-i);
+      for (unsigned k=0; k<ncol(); ++k) {
+        is.read(reinterpret_cast<char*>(buf[k].data()),n*8);
+        c[k] = buf[k].data();
+      }
+      if (!is) throw error("column_store: unexpected end of input");
+      append(c.data(),n);
+    }
+  }
+
+  // append the rows in memory to the files
+  void spill() {
+    if (!budget) return;
+    if (name.empty()) name = budget->next_name();
+    const size_t n = cols.empty() ? 0 : cols[0].size();
+    for (unsigned k=0; k<cols.size(); ++k) {
+      std::ofstream f(file(k),std::ios::binary|std::ios::app);
+      f.write(reinterpret_cast<const char*>(cols[k].data()),n*8);
+      if (!f) throw error("column_store: cannot write ",file(k));
+      std::vector<double>().swap(cols[k]);
+    }
+    n_disk += n;
+    account();
+  }
+
+  // Call before col() if spilled
+  void finish() {
+    if (!n_disk || !maps.empty()) return;
+    spill();
+    for (unsigned k=0; k<cols.size(); ++k) {
+      const int fd = ::open(file(k).c_str(),O_RDONLY);
+      void* p = fd < 0 ? MAP_FAILED
+        : mmap(nullptr,n_disk*8,PROT_READ,MAP_SHARED,fd,0);
+      if (fd >= 0) ::close(fd);
+      if (p == MAP_FAILED) throw error("column_store: cannot map ",file(k));
+      madvise(p,n_disk*8,MADV_SEQUENTIAL);
+      maps.emplace_back(p,n_disk*8);
+    }
+  }
+
+  // Have the kernel read a spilled store ahead, e.g. the next bin while
+  // the current one is fitted
+  void prefetch() const noexcept {
+    for (const auto& m : maps) madvise(m.first,m.second,MADV_WILLNEED);
+  }
+
+  inline const double* col(unsigned k) const noexcept {
+    return maps.empty() ? cols[k].data()
+      : static_cast<const double*>(maps[k].first);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_CPU_DISPATCH_HH
+#define IVANP_CPU_DISPATCH_HH
+
+// Runtime selection of ISA specific kernel variants
+//
+// The best level supported by the CPU is selected at first use.
+// Programs using the kernels take --isa generic|sse4.2|avx2|avx512 to
+// override it, or else the ANGLES_ISA environment variable, and call
+// init() after parsing their options, so that the choice is logged at
+// startup. A lower level than detected can always be forced; a higher
+// level falls back to the detected one with a warning.
+
+#include <cstdlib>
+#include <cstring>
+
+#include "tc_msg.hh"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IVANP_CPU_DISPATCH
+#define IVANP_TARGET(ISA) __attribute__((target(ISA)))
+#else
+#define IVANP_TARGET(ISA)
+#endif
+
+#define IVANP_TARGET_SSE42  IVANP_TARGET("sse4.2")
+#define IVANP_TARGET_AVX2   IVANP_TARGET("avx2,fma")
+#define IVANP_TARGET_AVX512 IVANP_TARGET("avx512f,avx512dq,avx2,fma")
+
+namespace ivanp { namespace cpu {
+
+enum class isa { generic, sse42, avx2, avx512 };
+
+constexpr const char* isa_names[] = { "generic", "sse4.2", "avx2", "avx512" };
+
+inline const char* str(isa i) noexcept { return isa_names[int(i)]; }
+
+inline isa detect() noexcept {
+#ifdef IVANP_CPU_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+    return isa::avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return isa::avx2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return isa::sse42;
+#endif
+  return isa::generic;
+}
+
+// ISA name given by a program option, read at the first selected()
+inline const char*& requested() noexcept {
+  static const char* name = nullptr;
+  return name;
+}
+
+inline isa selected() {
+  static const isa sel = []{
+    const isa det = detect();
+    isa i = det;
+    const char* name = requested();
+    if (!name) name = std::getenv("ANGLES_ISA");
+    if (name) {
+      int k = 0;
+      for (; k<4; ++k) if (!strcmp(name,isa_names[k])) break;
+      if (k==4) warning("Unknown ISA",name);
+      else if (isa(k) > det)
+        warning("ISA",name,"is not supported by this CPU");
+      else i = isa(k);
+    }
+    info("Kernels ISA",str(i));
+    return i;
+  }();
+  return sel;
+}
+
+// select now, with the --isa option if given
+inline isa init(const char* name = nullptr) {
+  if (name) requested() = name;
+  return selected();
+}
+
+// pick the variant for the selected ISA
+template <typename F>
+inline F select(F generic, F sse42, F avx2, F avx512) {
+  switch (selected()) {
+    case isa::avx512: return avx512;
+    case isa::avx2  : return avx2;
+    case isa::sse42 : return sse42;
+    default         : return generic;
+  }
+}
+
+}}
+
+#endif
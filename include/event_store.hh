@@ -0,0 +1,304 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_EVENT_STORE_HH
+#define IVANP_EVENT_STORE_HH
+
+// Per-bin event arrays shared by the processes on one node
+//
+// A store is a file, in /dev/shm to keep it in shared memory, named by
+// the hash of everything its content depends on. The first process
+// fills and publishes it, the others map it read-only. Producers are
+// serialized by a lock file, and a store is renamed into place only
+// when complete, so it is never seen half written.
+// Stores are not removed here: the jobs using a directory of stores
+// delete it when the last one exits, as scan/run.sh does.
+//
+// Layout: header, event count per bin, then the x and w arrays of
+// every bin, each aligned to 64 bytes.
+//
+// An arena holds the arrays of all bins in the same layout in memory,
+// each exactly the size of its bin. The events are counted first.
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.hh"
+#include "column_store.hh"
+
+namespace ivanp { namespace event_store {
+
+constexpr char magic[8] = { 'I','V','A','N','P','E','V','S' };
+constexpr uint32_t version = 1;
+constexpr uint64_t align = 64;
+
+struct header {
+  char magic[8];
+  uint32_t version, nbins;
+  uint64_t size; // of the whole file
+};
+
+inline uint64_t aligned(uint64_t n) noexcept {
+  return (n + align - 1) & ~(align - 1);
+}
+
+struct bin_view {
+  const double *x, *w;
+  size_t n;
+  inline size_t size() const noexcept { return n; }
+};
+
+// Have the kernel read the pages of a bin ahead, e.g. of an arena in the
+// spill directory, for the next bin while the current one is fitted
+inline void prefetch(const bin_view& b) noexcept {
+  if (!b.n) return;
+  static const uintptr_t page = sysconf(_SC_PAGESIZE);
+  for (const double* p : { b.x, b.w }) {
+    const uintptr_t a = uintptr_t(p) & ~(page-1);
+    madvise(reinterpret_cast<void*>(a),
+      uintptr_t(p+b.n) - a, MADV_WILLNEED);
+  }
+}
+
+class store {
+  void* addr = MAP_FAILED;
+  size_t len = 0;
+  std::vector<bin_view> bins_;
+
+  void unmap() noexcept {
+    if (addr != MAP_FAILED) munmap(addr,len);
+    addr = MAP_FAILED;
+    bins_.clear();
+  }
+
+public:
+  store() = default;
+  store(const store&) = delete;
+  store& operator=(const store&) = delete;
+  store(store&& r) noexcept
+  : addr(r.addr), len(r.len), bins_(std::move(r.bins_)) {
+    r.addr = MAP_FAILED;
+  }
+  store& operator=(store&& r) noexcept {
+    if (this != &r) {
+      unmap();
+      addr = r.addr;
+      len = r.len;
+      bins_ = std::move(r.bins_);
+      r.addr = MAP_FAILED;
+    }
+    return *this;
+  }
+  ~store() { unmap(); }
+
+  inline const std::vector<bin_view>& bins() const noexcept { return bins_; }
+
+  // false if there is no valid store at path
+  bool attach(const std::string& path) {
+    unmap();
+    const int fd = ::open(path.c_str(),O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd,&st) || size_t(st.st_size) < sizeof(header)) {
+      ::close(fd);
+      return false;
+    }
+    len = st.st_size;
+    addr = mmap(nullptr,len,PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    const char* p = static_cast<const char*>(addr);
+    header h;
+    memcpy(&h,p,sizeof(h));
+    if (memcmp(h.magic,magic,sizeof(magic)) || h.version!=version
+        || h.size!=len || len < sizeof(h) + h.nbins*sizeof(uint64_t)) {
+      unmap();
+      return false;
+    }
+    const uint64_t* n = reinterpret_cast<const uint64_t*>(p + sizeof(h));
+    uint64_t offset = aligned(sizeof(h) + h.nbins*sizeof(uint64_t));
+    bins_.reserve(h.nbins);
+    for (uint32_t i=0; i<h.nbins; ++i) {
+      const uint64_t bytes = aligned(n[i]*sizeof(double));
+      if (offset + 2*bytes > len) { unmap(); return false; }
+      bins_.push_back({
+        reinterpret_cast<const double*>(p + offset),
+        reinterpret_cast<const double*>(p + offset + bytes), n[i] });
+      offset += 2*bytes;
+    }
+    return true;
+  }
+
+  // Write bins to path
+  static void publish(const std::string& path,
+    const std::vector<bin_view>& bins
+  ) {
+    std::vector<uint64_t> n;
+    for (const auto& b : bins) n.push_back(b.n);
+    header h;
+    memcpy(h.magic,magic,sizeof(magic));
+    h.version = version;
+    h.nbins = n.size();
+    h.size = aligned(sizeof(h) + n.size()*sizeof(uint64_t));
+    for (auto k : n) h.size += 2*aligned(k*sizeof(double));
+
+    const std::string tmp = path+".tmp"+std::to_string(getpid());
+    { std::ofstream f(tmp,std::ios::binary);
+      const char zeros[align] = { };
+      auto pad = [&]{
+        f.write(zeros, aligned(uint64_t(f.tellp())) - uint64_t(f.tellp()));
+      };
+      f.write(reinterpret_cast<const char*>(&h),sizeof(h));
+      f.write(reinterpret_cast<const char*>(n.data()),n.size()*sizeof(n[0]));
+      pad();
+      for (const auto& b : bins) {
+        f.write(reinterpret_cast<const char*>(b.x),b.n*sizeof(double));
+        pad();
+        f.write(reinterpret_cast<const char*>(b.w),b.n*sizeof(double));
+        pad();
+      }
+      if (!f) {
+        std::remove(tmp.c_str());
+        throw error("cannot write ",tmp);
+      }
+    }
+    if (std::rename(tmp.c_str(),path.c_str()))
+      throw error("cannot write ",path);
+  }
+};
+
+// Filled in two passes: count() the events of every bin, allocate(),
+// then push() them. Above the budget the arena is an unlinked file in
+// the spill directory, paged out by the kernel rather than by us.
+class arena {
+  void* addr = MAP_FAILED;
+  size_t len = 0;
+  spill_budget* budget = nullptr; // if counted in it
+  std::vector<uint64_t> n; // events per bin
+  std::vector<uint64_t> filled;
+  std::vector<double*> x, w;
+
+  void release() noexcept {
+    if (addr != MAP_FAILED) munmap(addr,len);
+    addr = MAP_FAILED;
+    if (budget) budget->used -= len;
+    budget = nullptr;
+  }
+
+public:
+  arena() = default;
+  explicit arena(unsigned nbins): n(nbins), filled(nbins) { }
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+  arena(arena&& r) noexcept
+  : addr(r.addr), len(r.len), budget(r.budget), n(std::move(r.n)),
+    filled(std::move(r.filled)), x(std::move(r.x)), w(std::move(r.w)) {
+    r.addr = MAP_FAILED;
+    r.budget = nullptr;
+  }
+  arena& operator=(arena&& r) noexcept {
+    if (this != &r) {
+      release();
+      addr = r.addr;
+      len = r.len;
+      budget = r.budget;
+      n = std::move(r.n);
+      filled = std::move(r.filled);
+      x = std::move(r.x);
+      w = std::move(r.w);
+      r.addr = MAP_FAILED;
+      r.budget = nullptr;
+    }
+    return *this;
+  }
+  ~arena() { release(); }
+
+  inline unsigned nbins() const noexcept { return n.size(); }
+  inline void count(unsigned bin, uint64_t k = 1) noexcept { n[bin] += k; }
+
+  void allocate(spill_budget* b = nullptr) {
+    if (addr != MAP_FAILED) throw error("arena: allocated twice");
+    len = 0;
+    for (auto k : n) len += 2*aligned(k*sizeof(double));
+    x.assign(n.size(),nullptr);
+    w.assign(n.size(),nullptr);
+    if (!len) return;
+    if (b && b->used + len > b->limit) {
+      const std::string name = b->next_name()+".arena";
+      const int fd = ::open(name.c_str(),O_CREAT|O_RDWR|O_TRUNC,0600);
+      if (fd < 0) throw error("cannot create ",name);
+      if (!ftruncate(fd,len))
+        addr = mmap(nullptr,len,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+      ::close(fd);
+      std::remove(name.c_str()); // gone with the mapping
+      if (addr == MAP_FAILED) throw error("cannot map ",name);
+    } else {
+      addr = mmap(nullptr,len,PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+      if (addr == MAP_FAILED) throw error("arena: cannot allocate ",len);
+      if ((budget = b)) budget->used += len;
+    }
+    char* p = static_cast<char*>(addr);
+    for (unsigned i=0; i<n.size(); ++i) {
+      const uint64_t bytes = aligned(n[i]*sizeof(double));
+      x[i] = reinterpret_cast<double*>(p);
+      w[i] = reinterpret_cast<double*>(p + bytes);
+      p += 2*bytes;
+    }
+  }
+
+  // at most the counted number of events per bin
+  inline void push(unsigned bin, double xi, double wi) {
+    const uint64_t i = filled[bin]++;
+    if (i >= n[bin]) throw error("arena: more events than counted");
+    x[bin][i] = xi;
+    w[bin][i] = wi;
+  }
+
+  inline bin_view view(unsigned bin) const noexcept {
+    return { x[bin], w[bin], filled[bin] };
+  }
+  std::vector<bin_view> views() const {
+    std::vector<bin_view> v;
+    for (unsigned i=0; i<n.size(); ++i) v.push_back(view(i));
+    return v;
+  }
+};
+
+// Map the store at path, first creating it from fill() if necessary
+// fill returns the bins, as a std::vector<bin_view>
+template <typename Fill>
+store open(const std::string& path, Fill&& fill) {
+  store s;
+  if (s.attach(path)) return s;
+
+  const std::string lock_name = path+".lock";
+  const int lock = ::open(lock_name.c_str(),O_CREAT|O_RDWR,0644);
+  if (lock < 0 || flock(lock,LOCK_EX))
+    throw error("cannot lock ",lock_name);
+  try {
+    if (!s.attach(path)) { // not published while waiting for the lock
+      store::publish(path,fill());
+      if (!s.attach(path)) throw error("cannot map ",path);
+    }
+  } catch (...) {
+    ::close(lock);
+    throw;
+  }
+  ::close(lock);
+  return s;
+}
+
+}}
+
+#endif
@@ -0,0 +1,153 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_FIT_CACHE_HH
+#define IVANP_FIT_CACHE_HH
+
+// Content addressed on-disk cache of per-bin fit results
+//
+// The key is a 128 bit hash of everything a fit depends on: the events
+// in the bin, the fit settings and fit_cache::version, which must be
+// bumped whenever a change to the fit code changes its results.
+// Entries are binner_io snapshots in <dir>/<key>, written atomically,
+// so several jobs may share a cache directory.
+//
+//   fit_cache::hasher h;
+//   h(x)(w)(lo)(hi)(npar);
+//   if (!cache.get(h.hex(),result)) { fit(); cache.put(h.hex(),result); }
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <type_traits>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "binner_io.hh"
+
+namespace ivanp { namespace fit_cache {
+
+constexpr const char* version = "hj-fit-2";
+
+class hasher {
+  uint64_t a = 0x9E3779B97F4A7C15ull, b = 0xC2B2AE3D27D4EB4Full;
+  uint64_t len = 0;
+
+  static inline uint64_t rotl(uint64_t x, int r) noexcept {
+    return (x << r) | (x >> (64 - r));
+  }
+  static inline uint64_t fmix(uint64_t k) noexcept { // murmur3 finalizer
+    k ^= k >> 33; k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+  }
+  inline void word(uint64_t w) noexcept {
+    a = rotl(a ^ fmix(w), 27)*5 + 0x52dce729;
+    b = rotl(b + fmix(w ^ 0x87c37b91114253d5ull), 31)*5 + 0x38495ab5;
+  }
+
+public:
+  hasher& add(const void* p, size_t n) noexcept {
+    const char* c = static_cast<const char*>(p);
+    len += n;
+    for (; n>=8; n-=8, c+=8) {
+      uint64_t w;
+      memcpy(&w,c,8);
+      word(w);
+    }
+    uint64_t w = n; // tail, with its length
+    memcpy(reinterpret_cast<char*>(&w)+1,c,n);
+    word(w);
+    return *this;
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_trivially_copyable<T>::value,hasher&>
+  operator()(const T& x) noexcept { return add(&x,sizeof(T)); }
+
+  template <typename T>
+  hasher& operator()(const std::vector<T>& x) noexcept {
+    static_assert(std::is_trivially_copyable<T>::value,"");
+    (*this)(uint64_t(x.size()));
+    return add(x.data(),x.size()*sizeof(T));
+  }
+  hasher& operator()(const char* str) noexcept {
+    return add(str,strlen(str));
+  }
+  hasher& operator()(const std::string& str) noexcept {
+    return add(str.data(),str.size());
+  }
+
+  std::string hex() const {
+    const uint64_t h[2] = { fmix(a ^ len), fmix(b + a) };
+    char s[33];
+    snprintf(s,sizeof(s),"%016llx%016llx",
+      (unsigned long long)h[0], (unsigned long long)h[1]);
+    return s;
+  }
+};
+
+// hash of a file's content
+inline std::string file_hash(const std::string& name) {
+  std::ifstream f(name,std::ios::binary);
+  if (!f) throw error("cannot read ",name);
+  hasher h;
+  std::vector<char> buf(1<<20);
+  while (f) {
+    f.read(buf.data(),buf.size());
+    h.add(buf.data(),f.gcount());
+  }
+  return h.hex();
+}
+
+class cache {
+  std::string dir;
+public:
+  long unsigned hits = 0, misses = 0;
+
+  cache() = default;
+  // an empty dir disables the cache
+  cache(const std::string& dir): dir(dir) {
+    if (!dir.empty()) mkdir(dir.c_str(),0755);
+  }
+  inline explicit operator bool() const noexcept { return !dir.empty(); }
+
+  // false if missing or unreadable
+  template <typename... T>
+  bool get(const std::string& key, T&... xs) {
+    if (dir.empty()) return false;
+    std::ifstream f(dir+'/'+key,std::ios::binary);
+    if (f) try {
+      std::string v;
+      io::read_snapshot(f,v,xs...);
+      if (v==version) { ++hits; return true; }
+    } catch (const std::exception&) { }
+    ++misses;
+    return false;
+  }
+
+  // failures are ignored, the entry is then just missing
+  template <typename... T>
+  void put(const std::string& key, const T&... xs) {
+    if (dir.empty()) return;
+    const std::string name = dir+'/'+key,
+      tmp = name+".tmp"+std::to_string(getpid());
+    try {
+      { std::ofstream f(tmp,std::ios::binary);
+        io::write_snapshot(f,std::string(version),xs...);
+      }
+      std::rename(tmp.c_str(),name.c_str());
+    } catch (const std::exception&) {
+      std::remove(tmp.c_str());
+    }
+  }
+};
+
+}}
+
+#endif
@@ -0,0 +1,117 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_FIT_RESULTS_HH
+#define IVANP_FIT_RESULTS_HH
+
+// Typed table of per-bin fit results
+//
+// Stored as the "fit_results" TTree next to the histograms, one row per
+// mass bin, so that post-processing needs neither the histograms nor
+// the TF1 titles.
+
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include <TTree.h>
+#include <TMinuit.h>
+
+#include "catstr.hh"
+
+namespace ivanp { namespace hj {
+
+constexpr unsigned npar_max = 4;
+constexpr const char* par_names[npar_max] = {"c2","c4","c6","#phi2"};
+
+constexpr const char* fit_results_name = "fit_results";
+
+struct fit_row {
+  static constexpr unsigned N = npar_max;
+  double lo, hi; // mass bin edges
+  Int_t npar; // free parameters
+  double pars[N], errs[N];
+  double cov[N*N]; // rows and columns of fixed parameters are zero
+  double logl, chi2; // -2LogL and χ²
+  Int_t status, nfcn; // Migrad status and function calls
+  Long64_t events;
+
+  inline bool operator<(const fit_row& r) const noexcept {
+    return lo < r.lo || (lo == r.lo && hi < r.hi);
+  }
+};
+
+// Covariance of a Minuit fit with n external parameters,
+// free[i] tells whether parameter i was free
+template <typename Free>
+void get_covariance(TMinuit& m, unsigned n, Free&& free, double* cov) {
+  std::fill(cov,cov+n*n,0.);
+  std::vector<unsigned> ext;
+  for (unsigned i=0; i<n; ++i) if (free(i)) ext.push_back(i);
+  const unsigned nf = ext.size();
+  if (!nf) return;
+  std::vector<double> emat(nf*nf);
+  m.mnemat(emat.data(),nf);
+  for (unsigned i=0; i<nf; ++i)
+    for (unsigned j=0; j<nf; ++j)
+      cov[ext[i]*n+ext[j]] = emat[i*nf+j];
+}
+
+class fit_results_writer {
+  TTree *tree;
+  fit_row row;
+public:
+  // the tree is created in the current directory
+  fit_results_writer(): tree(new TTree(fit_results_name,"fit results")) {
+    constexpr auto N = fit_row::N;
+    tree->Branch("lo",&row.lo,"lo/D");
+    tree->Branch("hi",&row.hi,"hi/D");
+    tree->Branch("npar",&row.npar,"npar/I");
+    tree->Branch("pars",row.pars,cat("pars[",N,"]/D").c_str());
+    tree->Branch("errs",row.errs,cat("errs[",N,"]/D").c_str());
+    tree->Branch("cov",row.cov,cat("cov[",N*N,"]/D").c_str());
+    tree->Branch("logl",&row.logl,"logl/D");
+    tree->Branch("chi2",&row.chi2,"chi2/D");
+    tree->Branch("status",&row.status,"status/I");
+    tree->Branch("nfcn",&row.nfcn,"nfcn/I");
+    tree->Branch("events",&row.events,"events/L");
+  }
+  inline void fill(const fit_row& r) {
+    row = r;
+    tree->Fill();
+  }
+  inline void write() { tree->Write(0,TObject::kOverwrite); }
+};
+
+// All rows, sorted by bin; empty if dir has no table
+template <typename Dir>
+std::vector<fit_row> read_fit_results(Dir* dir) {
+  std::vector<fit_row> rows;
+  TTree *tree = nullptr;
+  dir->GetObject(fit_results_name,tree);
+  if (!tree) return rows;
+  fit_row row;
+  tree->SetBranchAddress("lo",&row.lo);
+  tree->SetBranchAddress("hi",&row.hi);
+  tree->SetBranchAddress("npar",&row.npar);
+  tree->SetBranchAddress("pars",row.pars);
+  tree->SetBranchAddress("errs",row.errs);
+  tree->SetBranchAddress("cov",row.cov);
+  tree->SetBranchAddress("logl",&row.logl);
+  tree->SetBranchAddress("chi2",&row.chi2);
+  tree->SetBranchAddress("status",&row.status);
+  tree->SetBranchAddress("nfcn",&row.nfcn);
+  tree->SetBranchAddress("events",&row.events);
+  const Long64_t n = tree->GetEntries();
+  rows.reserve(n);
+  for (Long64_t i=0; i<n; ++i) {
+    tree->GetEntry(i);
+    rows.push_back(row);
+  }
+  delete tree;
+  std::sort(rows.begin(),rows.end());
+  return rows;
+}
+
+}}
+
+#endif
@@ -97,6 +97,10 @@ public:
     return (is_double ? (*d_ptr())[i] : (*f_ptr())[i]);
   }
 
+  inline size_t size() noexcept {
+    return (is_double ? d_ptr()->GetSize() : f_ptr()->GetSize());
+  }
+
   const char* GetBranchName() const noexcept {
     return (is_double ? d_ptr()->GetBranchName() : f_ptr()->GetBranchName());
   }
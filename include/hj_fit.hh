@@ -0,0 +1,193 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_HJ_FIT_HH
+#define IVANP_HJ_FIT_HH
+
+// Fit of the cos θ distribution in one Higgs+jet mass bin, as in fit.cc
+// A binned χ² fit gives the starting values for the unbinned -2LogL fit.
+// fit.cc makes the χ² fit with the same chi2_function and chi2_fit.
+// Parameters beyond npar, or in the fixed mask, stay at their initial values.
+
+#include <array>
+#include <string>
+#include <memory>
+#include <cmath>
+
+#include <TH1.h>
+#include <TF1.h>
+#include <TFitResult.h>
+
+#include "minuit.hh"
+#include "binner.hh"
+#include "math.hh"
+#include "Legendre.hh"
+#include "kernels.hh"
+#include "fit_results.hh"
+#include "prof.hh"
+
+namespace ivanp { namespace hj {
+
+struct fit_options {
+  unsigned npar = npar_max;
+  unsigned fixed = 0; // bit i fixes parameter i
+  std::array<double,npar_max> init {{0,0,0,0}};
+  std::array<std::array<double,2>,npar_max> limits {{
+    {{-1e-4,2.}}, {{0.,0.}}, {{0.,0.}}, {{-1e-4,M_PI}}
+  }};
+  double step = 0.01;
+  unsigned nbins = 100; // cos θ bins of the χ² fit
+  bool use_chi2_pars = false; // start the LogL fit from the χ² fit
+  int print_level = 0;
+
+  inline bool is_fixed(unsigned i) const noexcept {
+    return i >= npar || (fixed >> i & 1u);
+  }
+  unsigned nfree() const noexcept {
+    unsigned n = 0;
+    for (unsigned i=0; i<npar_max; ++i) n += !is_fixed(i);
+    return n;
+  }
+};
+
+struct fit_result {
+  std::array<double,npar_max+1> chi2_pars { }, chi2_errs { }; // A is last
+  std::array<double,npar_max> pars { }, errs { };
+  std::array<double,npar_max*npar_max> cov { }; // of the LogL fit
+  double chi2 = 0, logl = 0; // χ² and -2LogL at the minima
+  int status = -1; // Migrad status of the LogL fit, -1 if not fitted
+  int nfcn = 0; // LogL evaluations
+
+  // row of the fit results table
+  // nfree: number of free parameters, fit_options::nfree()
+  fit_row row(double lo, double hi, unsigned nfree, long n) const noexcept {
+    fit_row r { lo, hi, int(nfree) };
+    std::copy(pars.begin(),pars.end(),r.pars);
+    std::copy(errs.begin(),errs.end(),r.errs);
+    std::copy(cov.begin(),cov.end(),r.cov);
+    r.logl = logl;
+    r.chi2 = chi2;
+    r.status = status;
+    r.nfcn = nfcn;
+    r.events = n;
+    return r;
+  }
+};
+
+// prof timer of one fit step, per bin if name is not empty
+// A server fitting arbitrary binnings leaves name empty, so that
+// the registry does not grow with every request.
+inline prof::entry& fit_timer(const char* step, const std::string& name) {
+  return prof::get(name.empty() ? std::string(step) : step+(' '+name));
+}
+
+struct cos_bin {
+  double w = 0, w2 = 0;
+  inline void operator()(double weight) noexcept {
+    w  += weight;
+    w2 += weight*weight;
+  }
+};
+
+// cos θ histogram of a fit, with overflow as TH1::Fill
+using cos_hist = binner<cos_bin, std::tuple<
+  axis_spec<uniform_axis<double>, false, true> > >;
+
+// Fill h from cos θ and weights, or unit weights if w is nullptr
+template <typename T>
+void fill_cos_hist(TH1* h, size_t n, const T* x, const T* w) {
+  prof::scope t_(prof::get("histogram"));
+  cos_hist hb(uniform_axis<double>(h->GetNbinsX(),-1.,1.));
+  if (w) hb.fill_batch(n,x,w);
+  else for (size_t i=0; i<n; ++i) hb(x[i],1.);
+  const auto& b = hb.bins();
+  for (unsigned i=0; i<b.size(); ++i) {
+    h->SetBinContent(i+1,b[i].w);
+    h->SetBinError(i+1,std::sqrt(b[i].w2));
+  }
+  h->SetEntries(n);
+}
+
+// χ² fit function: A·Legendre, with A as parameter 0
+inline TF1* chi2_function(const fit_options& opt) {
+  TF1 *f = new TF1("fit-chi2",
+    [](const double* x, const double* c){ return c[0]*Legendre(x,c+1); },
+    -1.,1.,npar_max+1);
+  f->SetLineColor(418);
+  f->SetParName(0,"A");
+  for (unsigned i=0; i<npar_max; ++i) {
+    f->SetParName(i+1,par_names[i]);
+    f->SetParameter(i+1,opt.init[i]);
+    f->SetParLimits(i+1,opt.limits[i][0],opt.limits[i][1]);
+  }
+  for (unsigned i=0; i<npar_max; ++i)
+    if (opt.is_fixed(i)) f->FixParameter(i+1,opt.init[i]);
+  if (opt.nbins<100) f->SetNpx(std::ceil(91./opt.nbins)*opt.nbins);
+  return f;
+}
+
+// Binned χ² fit of h with f from chi2_function, by TH1::Fit
+// A starts from the integral, overflow included. The fitted copy of f
+// is added to the list of functions of h. Returns χ².
+inline double chi2_fit(
+  TH1* h, TF1* f, const fit_options& opt, const std::string& name = { }
+) {
+  f->SetParameter(0,h->Integral(1,h->GetNbinsX()+1));
+  auto result = prof::timed(fit_timer("chi2 fit",name),
+    [&]{ return h->Fit(f, opt.print_level < 0 ? "SR0Q" : "SR0V"); });
+  return result->Chi2();
+}
+
+// x: cos θ in [-1,1], w: weights or nullptr
+// name labels the prof timers, see fit_timer
+inline fit_result fit(
+  const double* x, const double* w, size_t n,
+  const fit_options& opt, const std::string& name = { }
+) {
+  constexpr unsigned N = npar_max;
+  fit_result r;
+  if (n==0) return r;
+
+  TH1D h("cos_theta","",opt.nbins,-1.,1.);
+  h.SetDirectory(nullptr);
+  fill_cos_hist(&h,n,x,w);
+
+  auto& t_logl = fit_timer("logl",name);
+  auto fLogL = [=,&t_logl](const double* c) -> double {
+    prof::scope t_(t_logl);
+    return kernels::logl(x,w,n,c);
+  };
+
+  // χ² fit ---------------------------------------------------------
+  const std::unique_ptr<TF1> fChi2(chi2_function(opt));
+  r.chi2 = chi2_fit(&h,fChi2.get(),opt,name);
+  const TF1* f = static_cast<TF1*>(h.GetListOfFunctions()->At(0));
+  for (unsigned i=0; i<=N; ++i) { // A last
+    r.chi2_pars[i] = f->GetParameter((i+1)%(N+1));
+    r.chi2_errs[i] = f->GetParError((i+1)%(N+1));
+  }
+
+  // LogL fit -------------------------------------------------------
+  minuit<decltype(fLogL)> mLogL(N,fLogL);
+  mLogL.SetPrintLevel(opt.print_level);
+  for (unsigned i=0; i<N; ++i)
+    mLogL.DefineParameter(i, par_names[i],
+      opt.use_chi2_pars ? r.chi2_pars[i] : opt.init[i], opt.step,
+      opt.limits[i][0], opt.limits[i][1]);
+  for (unsigned i=0; i<N; ++i)
+    if (opt.is_fixed(i)) mLogL.FixParameter(i);
+
+  r.status = prof::timed(fit_timer("logl fit",name),
+    [&]{ return mLogL.Migrad(); });
+  for (unsigned i=0; i<N; ++i)
+    mLogL.GetParameter(i,r.pars[i],r.errs[i]);
+  get_covariance(mLogL,N,[&](unsigned i){ return !opt.is_fixed(i); },
+    r.cov.data());
+  r.nfcn = mLogL.fNfcn;
+  r.logl = fLogL(r.pars.data());
+
+  return r;
+}
+
+}}
+
+#endif
@@ -0,0 +1,315 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_KERNELS_HH
+#define IVANP_KERNELS_HH
+
+// Hot loops compiled for several ISA levels, see cpu_dispatch.hh
+//
+// Each kernel body is an always_inline template, instantiated inside
+// a wrapper per target, so the same source is vectorized for each ISA.
+// The targets include FMA, so floating point contraction is turned off
+// for this header. Without -ffast-math the variants then give bitwise
+// identical results, which bench_micro checks.
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "cpu_dispatch.hh"
+#include "axis.hh"
+
+#define IVANP_ALWAYS_INLINE inline __attribute__((always_inline))
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+namespace ivanp { namespace kernels {
+
+// Natural log without branches or calls, so that loops over it vectorize
+// Cephes rational approximation, within 1 ulp of std::log
+template <typename=void>
+IVANP_ALWAYS_INLINE double vlog(double x) noexcept {
+  using lim = std::numeric_limits<double>;
+  const bool sub = x < lim::min(); // scale up subnormals
+  const double xs = sub ? x*0x1p54 : x;
+  uint64_t bits;
+  std::memcpy(&bits,&xs,sizeof(xs));
+  const int hi = int(bits >> 32);
+  double e = ((hi >> 20) & 0x7ff) - (sub ? 1022+54 : 1022);
+  bits = (bits & 0x800fffffffffffffull) | 0x3fe0000000000000ull;
+  double m;
+  std::memcpy(&m,&bits,sizeof(m)); // x = m*2^e, m in [0.5,1)
+
+  const bool lo = m < 0.70710678118654752440;
+  e = lo ? e-1. : e;
+  m = lo ? m+m-1. : m-1.;
+
+  const double z = m*m;
+  const double p = ((((
+      1.01875663804580931796E-4  * m
+    + 4.97494994976747001425E-1) * m
+    + 4.70579119878881725854E0 ) * m
+    + 1.44989225341610930846E1 ) * m
+    + 1.79368678507819816313E1 ) * m
+    + 7.70838733755885391666E0;
+  const double q = ((((
+      m + 1.12873587189167450590E1) * m
+        + 4.52279145837532221105E1) * m
+        + 8.29875266912776603211E1) * m
+        + 7.11544750618563894466E1) * m
+        + 2.31251620126765340583E1;
+
+  double y = m*(z*p/q) - e*2.121944400546905827679e-4 - 0.5*z;
+  y = m + y + e*0.693359375;
+
+  // zero, negative, inf and nan inputs
+  const bool finite = x > 0 && x < lim::infinity();
+  return finite ? y : ( x == 0 ? -lim::infinity()
+                      : x == lim::infinity() ? x : lim::quiet_NaN() );
+}
+
+// Legendre() with the parameter dependent terms computed once
+struct legendre_pars {
+  double c0, a, b, c4, c6;
+  legendre_pars(const double* c) noexcept
+  : c0(std::sqrt( 0.5 - (0.2*c[0]*c[0] + (1./9.)*c[1]*c[1]
+                       + (1./13.)*c[2]*c[2]) )),
+    a(c[0]*std::cos(c[3])), b(c[0]*std::sin(c[3])),
+    c4(c[1]), c6(c[2]) { }
+
+  IVANP_ALWAYS_INLINE double operator()(double x) const noexcept {
+    const double x2 = x*x, x4 = x2*x2, x6 = x4*x2;
+    const double p2 = 1.5*x2 - 0.5;
+    const double p4 = 4.375*x4 - 3.75*x2 + 0.375;
+    const double p6 = 14.4375*x6 - 19.6875*x4 + 6.5625*x2 - 0.3125;
+    const double re = c0 + a*p2 + c4*p4 + c6*p6, im = b*p2;
+    return re*re + im*im;
+  }
+};
+
+// Sum of w[i]*log(Legendre(x[i])), or of log(Legendre(x[i])) if !W
+// Kahan summation in 8 lanes keeps the loop vectorizable
+// T is double, or float for compact events, converted on load
+template <bool W, typename T>
+IVANP_ALWAYS_INLINE double logl_impl(
+  const T* __restrict__ x, const T* __restrict__ w,
+  size_t n, const legendre_pars& f
+) noexcept {
+  constexpr unsigned L = 8;
+  double s[L] = { }, r[L] = { };
+  size_t i = 0;
+  for (; i+L<=n; i+=L) {
+    for (unsigned j=0; j<L; ++j) {
+      const double t = (W ? w[i+j] : 1.)*vlog(f(x[i+j])) - r[j];
+      const double u = s[j] + t;
+      r[j] = (u - s[j]) - t;
+      s[j] = u;
+    }
+  }
+  double sum = 0;
+  for (; i<n; ++i) sum += (W ? w[i] : 1.)*vlog(f(x[i]));
+  for (unsigned j=0; j<L; ++j) sum += s[j] - r[j];
+  return sum;
+}
+
+// Sums of w[k][i]*log(Legendre(x[i])) for nw weight columns, added to
+// sum[k]; the log is computed once per event for all the columns
+template <typename T>
+IVANP_ALWAYS_INLINE void logl_cols_impl(
+  const T* __restrict__ x, const T* const* w, unsigned nw,
+  size_t n, const legendre_pars& f, double* __restrict__ sum
+) noexcept {
+  constexpr unsigned B = 256, L = 8; // events per block, lanes
+  double l[B];
+  for (size_t i=0; i<n; i+=B) {
+    const unsigned m = std::min<size_t>(B,n-i);
+    for (unsigned j=0; j<m; ++j) l[j] = vlog(f(x[i+j]));
+    for (unsigned k=0; k<nw; ++k) {
+      const T* __restrict__ wk = w[k]+i;
+      double s[L] = { };
+      unsigned j = 0;
+      for (; j+L<=m; j+=L)
+        for (unsigned q=0; q<L; ++q) s[q] += wk[j+q]*l[j+q];
+      for (; j<m; ++j) s[0] += wk[j]*l[j];
+      for (unsigned q=0; q<L; ++q) sum[k] += s[q];
+    }
+  }
+}
+
+// cos θ and H+j mass, as in angles, for n events in SoA layout
+// p[0..3] = Higgs t,x,y,z; p[4..7] = jet t,x,y,z
+template <typename=void>
+IVANP_ALWAYS_INLINE void cos_theta_impl(
+  const double* const* p, size_t n,
+  double* __restrict__ mass, double* __restrict__ cos_theta
+) noexcept {
+  const double *__restrict__ Ht = p[0], *__restrict__ Hx = p[1],
+               *__restrict__ Hy = p[2], *__restrict__ Hz = p[3],
+               *__restrict__ jt = p[4], *__restrict__ jx = p[5],
+               *__restrict__ jy = p[6], *__restrict__ jz = p[7];
+  for (size_t i=0; i<n; ++i) {
+    const double Qt = Ht[i]+jt[i], Qx = Hx[i]+jx[i],
+                 Qy = Hy[i]+jy[i], Qz = Hz[i]+jz[i];
+    const double Q2 = Qt*Qt - (Qx*Qx + Qy*Qy + Qz*Qz);
+    const double QH = Qt*Ht[i] - (Qx*Hx[i] + Qy*Hy[i] + Qz*Hz[i]);
+    const double Qj = Qt*jt[i] - (Qx*jx[i] + Qy*jy[i] + Qz*jz[i]);
+    const double a = Qj/Q2, b = QH/Q2;
+    const double lt = a*Ht[i] - b*jt[i], lx = a*Hx[i] - b*jx[i],
+                 ly = a*Hy[i] - b*jy[i], lz = a*Hz[i] - b*jz[i];
+    // Z = (Qz,0,0,Qt)
+    const double lZ = lt*Qz - lz*Qt;
+    const double l2 = lt*lt - (lx*lx + ly*ly + lz*lz);
+    const double Z2 = Qz*Qz - Qt*Qt;
+    mass[i] = std::sqrt(Q2);
+    cos_theta[i] = lZ / std::sqrt(l2*Z2);
+  }
+}
+
+// ISA variants =====================================================
+#define IVANP_KERNEL_VARIANTS(TARGET,SUF) \
+  TARGET inline double logl_##SUF( \
+    const double* x, const double* w, size_t n, const legendre_pars& f \
+  ) noexcept { \
+    return w ? logl_impl<true>(x,w,n,f) : logl_impl<false>(x,w,n,f); \
+  } \
+  TARGET inline double logl_f_##SUF( \
+    const float* x, const float* w, size_t n, const legendre_pars& f \
+  ) noexcept { \
+    return w ? logl_impl<true>(x,w,n,f) : logl_impl<false>(x,w,n,f); \
+  } \
+  TARGET inline void logl_cols_##SUF( \
+    const double* x, const double* const* w, unsigned nw, size_t n, \
+    const legendre_pars& f, double* sum \
+  ) noexcept { logl_cols_impl(x,w,nw,n,f,sum); } \
+  TARGET inline void logl_cols_f_##SUF( \
+    const float* x, const float* const* w, unsigned nw, size_t n, \
+    const legendre_pars& f, double* sum \
+  ) noexcept { logl_cols_impl(x,w,nw,n,f,sum); } \
+  TARGET inline void cos_theta_##SUF( \
+    const double* const* p, size_t n, double* mass, double* cos_theta \
+  ) noexcept { cos_theta_impl(p,n,mass,cos_theta); } \
+  TARGET inline void find_bins_##SUF( \
+    const uniform_axis<double>& a, const double* x, \
+    axis_size_type n, axis_size_type* bins \
+  ) noexcept { a.find_bins(x,n,bins); }
+
+IVANP_KERNEL_VARIANTS(,generic)
+IVANP_KERNEL_VARIANTS(IVANP_TARGET_SSE42,sse42)
+IVANP_KERNEL_VARIANTS(IVANP_TARGET_AVX2,avx2)
+IVANP_KERNEL_VARIANTS(IVANP_TARGET_AVX512,avx512)
+
+#undef IVANP_KERNEL_VARIANTS
+
+#define IVANP_KERNEL_SELECT(NAME) \
+  static const auto f = cpu::select( \
+    NAME##_generic, NAME##_sse42, NAME##_avx2, NAME##_avx512);
+
+// Dispatched kernels ===============================================
+
+// -2 Σ w log(Legendre(x,c)), split between OpenMP threads if enabled
+template <typename T, typename F>
+inline double logl_chunks(
+  F f, const T* x, const T* w, size_t n, const double* c
+) {
+  const legendre_pars pars(c);
+  constexpr size_t chunk = 1<<12;
+  const long nchunks = (n + chunk - 1)/chunk;
+  long double sum = 0.;
+#ifdef _OPENMP
+  #pragma omp parallel for reduction(+:sum) schedule(static)
+#endif
+  for (long k=0; k<nchunks; ++k) {
+    const size_t first = k*chunk;
+    sum += f(x+first, w ? w+first : w, std::min(chunk,n-first), pars);
+  }
+  return -2.*sum;
+}
+
+inline double logl(
+  const double* x, const double* w, size_t n, const double* c
+) {
+  IVANP_KERNEL_SELECT(logl)
+  return logl_chunks(f,x,w,n,c);
+}
+// single precision events, double precision sums
+inline double logl(
+  const float* x, const float* w, size_t n, const double* c
+) {
+  IVANP_KERNEL_SELECT(logl_f)
+  return logl_chunks(f,x,w,n,c);
+}
+
+// -2 Σ w_k log(Legendre(x,c)) for nw weight columns w[k] in one pass
+// Chunks are summed in order, so the result does not depend on threads.
+template <typename T, typename F>
+inline void logl_cols_chunks(
+  F f, const T* x, const T* const* w, unsigned nw, size_t n,
+  const double* c, double* out
+) {
+  const legendre_pars pars(c);
+  constexpr size_t chunk = 1<<12;
+  const long nchunks = (n + chunk - 1)/chunk;
+  std::vector<double> sums(nchunks*nw);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for (long k=0; k<nchunks; ++k) {
+    const size_t first = k*chunk;
+    std::vector<const T*> wk(nw);
+    for (unsigned j=0; j<nw; ++j) wk[j] = w[j]+first;
+    f(x+first, wk.data(), nw, std::min(chunk,n-first), pars, &sums[k*nw]);
+  }
+  std::fill(out,out+nw,0.);
+  for (long k=0; k<nchunks; ++k)
+    for (unsigned j=0; j<nw; ++j) out[j] += sums[k*nw+j];
+  for (unsigned j=0; j<nw; ++j) out[j] *= -2.;
+}
+
+inline void logl_cols(
+  const double* x, const double* const* w, unsigned nw, size_t n,
+  const double* c, double* out
+) {
+  IVANP_KERNEL_SELECT(logl_cols)
+  logl_cols_chunks(f,x,w,nw,n,c,out);
+}
+// single precision events, double precision sums
+inline void logl_cols(
+  const float* x, const float* const* w, unsigned nw, size_t n,
+  const double* c, double* out
+) {
+  IVANP_KERNEL_SELECT(logl_cols_f)
+  logl_cols_chunks(f,x,w,nw,n,c,out);
+}
+
+inline void cos_theta(
+  const double* const* p, size_t n, double* mass, double* cos
+) {
+  IVANP_KERNEL_SELECT(cos_theta)
+  f(p,n,mass,cos);
+}
+
+inline void find_bins(
+  const uniform_axis<double>& a, const double* x,
+  axis_size_type n, axis_size_type* bins
+) {
+  IVANP_KERNEL_SELECT(find_bins)
+  f(a,x,n,bins);
+}
+
+#undef IVANP_KERNEL_SELECT
+
+} // end namespace kernels
+
+// Used by binner::fill_batch, in preference to the generic overload
+inline void find_bins(const uniform_axis<double>& a, const double* x,
+  axis_size_type n, axis_size_type* bins
+) { kernels::find_bins(a,x,n,bins); }
+
+} // end namespace ivanp
+
+#pragma GCC pop_options
+
+#endif
@@ -0,0 +1,193 @@
+// Written by Ivan Pogrebnyak
+
+#ifndef IVANP_PROF_HH
+#define IVANP_PROF_HH
+
+// Scoped timers and counters for the hot paths.
+//
+// Off unless the PROF_REPORT environment variable is set; the JSON
+// report is then written to that file at exit:
+//   {"name":{"n":calls,"s":seconds},"other":{"n":count}, ...}
+// When off, a timer costs one predictable branch.
+// Compiled with -DIVANP_NO_PROF, there is no registry: get() returns a
+// dummy entry and timers do nothing. Only building the names passed to
+// get() remains.
+// Forked workers reset() their copy of the counts and write() them to
+// their own file, which the parent merge()s into its report.
+//
+//   static auto& t_read = prof::get("read");
+//   { prof::scope _(t_read); tin->GetEntry(ent); }
+//   prof::get("events").add();
+
+#include <fstream>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+
+namespace ivanp { namespace prof {
+
+using clock_type = std::chrono::steady_clock;
+
+inline bool enabled() noexcept {
+#ifdef IVANP_NO_PROF
+  return false;
+#else
+  static const bool on = std::getenv("PROF_REPORT");
+  return on;
+#endif
+}
+
+struct entry {
+  const std::string name;
+  std::atomic<long unsigned> n { 0 }; // number of calls or counts
+  std::atomic<long unsigned> ns { 0 }; // total time in nanoseconds
+  std::atomic<bool> timed { false };
+
+  entry(const std::string& name): name(name) { }
+
+  inline void add(long unsigned k = 1) noexcept {
+    if (enabled()) n.fetch_add(k,std::memory_order_relaxed);
+  }
+  inline void add_time(long unsigned t) noexcept {
+    n.fetch_add(1,std::memory_order_relaxed);
+    ns.fetch_add(t,std::memory_order_relaxed);
+  }
+};
+
+#ifndef IVANP_NO_PROF
+
+class registry {
+  std::mutex mx;
+  std::deque<entry> entries; // stable addresses, report in creation order
+  std::unordered_map<std::string,entry*> index;
+
+  registry() = default;
+
+public:
+  static registry& instance() {
+    static registry r;
+    return r;
+  }
+  ~registry() { if (enabled()) write(std::getenv("PROF_REPORT")); }
+
+  entry& get(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mx);
+    auto& e = index[name];
+    if (!e) {
+      entries.emplace_back(name);
+      e = &entries.back();
+    }
+    return *e;
+  }
+
+  void write(const char* fname) {
+    std::lock_guard<std::mutex> lock(mx);
+    std::ofstream f(fname);
+    f.precision(6);
+    f << '{';
+    bool first = true;
+    for (const auto& e : entries) {
+      if (!first) f << ',';
+      else first = false;
+      f << "\n\"";
+      for (char c : e.name) {
+        if (c=='\"' || c=='\\') f << '\\';
+        f << c;
+      }
+      f << "\":{\"n\":" << e.n;
+      if (e.timed) f << ",\"s\":" << e.ns*1e-9;
+      f << '}';
+    }
+    f << "\n}\n";
+  }
+
+  // zero all the counts, e.g. in a forked process
+  void reset() {
+    std::lock_guard<std::mutex> lock(mx);
+    for (auto& e : entries) {
+      e.n = 0;
+      e.ns = 0;
+    }
+  }
+
+  // add the counts of a report written by write()
+  void merge(const char* fname) {
+    std::ifstream f(fname);
+    for (std::string line; std::getline(f,line); ) {
+      if (line.empty() || line[0]!='\"') continue;
+      std::string name;
+      size_t i = 1;
+      for (; i<line.size() && line[i]!='\"'; ++i) {
+        if (line[i]=='\\') ++i;
+        name += line[i];
+      }
+      entry& e = get(name);
+      const size_t n = line.find("\"n\":",i), t = line.find("\"s\":",i);
+      if (n!=std::string::npos)
+        e.n += std::strtoul(line.c_str()+n+4,nullptr,10);
+      if (t!=std::string::npos) {
+        e.timed = true;
+        e.ns += std::strtod(line.c_str()+t+4,nullptr)*1e9;
+      }
+    }
+  }
+};
+
+// look up once and keep the reference, e.g. in a static local
+inline entry& get(const std::string& name) {
+  return registry::instance().get(name);
+}
+
+inline void reset() { registry::instance().reset(); }
+inline void write(const char* fname) { registry::instance().write(fname); }
+inline void merge(const char* fname) { registry::instance().merge(fname); }
+
+class scope {
+  entry* e;
+  clock_type::time_point start;
+public:
+  scope(entry& e): e(enabled() ? &e : nullptr) {
+    if (this->e) {
+      e.timed.store(true,std::memory_order_relaxed);
+      start = clock_type::now();
+    }
+  }
+  scope(const scope&) = delete;
+  ~scope() {
+    if (e) e->add_time(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock_type::now() - start).count());
+  }
+};
+
+#else
+
+inline entry& get(const std::string&) noexcept {
+  static entry e("");
+  return e;
+}
+
+inline void reset() noexcept { }
+inline void write(const char*) noexcept { }
+inline void merge(const char*) noexcept { }
+
+struct scope {
+  scope(entry&) noexcept { }
+  scope(const scope&) = delete;
+};
+
+#endif
+
+// time a single expression, e.g. a loop condition
+template <typename F>
+inline decltype(auto) timed(entry& e, F&& f) {
+  scope _(e);
+  return f();
+}
+
+}}
+
+#endif
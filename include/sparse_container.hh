@@ -0,0 +1,187 @@
+#ifndef IVANP_SPARSE_CONTAINER_HH
+#define IVANP_SPARSE_CONTAINER_HH
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <iterator>
+#include <algorithm>
+
+#include "axis.hh"
+
+namespace ivanp {
+
+// Hash map backed bin container for binner.
+// Behaves like a vector of size() bins, but a bin is only allocated
+// when it is first accessed through the non-const operator[], which
+// is how binner fills. Reading an unallocated bin, with the const
+// operator[] or get(), returns a default constructed bin.
+// Iteration covers all size() indices in order and is read-only, also
+// on a non-const container, so that it never allocates. Use filled()
+// to visit only the allocated bins, in index order. binner algorithms
+// have overloads below that only allocate the bins they make non-empty.
+
+template <typename Bin>
+class sparse_container {
+public:
+  using value_type = Bin;
+  using size_type  = ivanp::axis_size_type;
+  using map_type   = std::unordered_map<size_type,value_type>;
+
+private:
+  map_type _bins;
+  size_type _size;
+
+  static const value_type& empty_bin() {
+    static const value_type bin{};
+    return bin;
+  }
+
+  template <typename P, typename M>
+  static std::vector<P> filled_impl(M& bins) {
+    std::vector<P> v;
+    v.reserve(bins.size());
+    for (auto& b : bins) v.emplace_back(b.first,&b.second);
+    std::sort(v.begin(),v.end(),
+      [](const P& a, const P& b){
+        return std::get<0>(a) < std::get<0>(b);
+      });
+    return v;
+  }
+
+  class basic_iterator {
+    const sparse_container* c;
+    size_type i;
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type        = Bin;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const Bin*;
+    using reference         = const Bin&;
+
+    basic_iterator(const sparse_container* c, size_type i): c(c), i(i) { }
+
+    inline reference operator*() const { return (*c)[i]; }
+    inline pointer operator->() const { return &(*c)[i]; }
+    inline reference operator[](difference_type n) const { return (*c)[i+n]; }
+
+    inline basic_iterator& operator++() noexcept { ++i; return *this; }
+    inline basic_iterator& operator--() noexcept { --i; return *this; }
+    inline basic_iterator operator++(int) noexcept { return {c,i++}; }
+    inline basic_iterator operator--(int) noexcept { return {c,i--}; }
+    inline basic_iterator& operator+=(difference_type n) noexcept
+    { i += n; return *this; }
+    inline basic_iterator& operator-=(difference_type n) noexcept
+    { i -= n; return *this; }
+    inline basic_iterator operator+(difference_type n) const noexcept
+    { return {c,size_type(i+n)}; }
+    inline basic_iterator operator-(difference_type n) const noexcept
+    { return {c,size_type(i-n)}; }
+    friend inline basic_iterator operator+(
+      difference_type n, const basic_iterator& it) noexcept
+    { return it + n; }
+    inline difference_type operator-(const basic_iterator& r) const noexcept
+    { return difference_type(i) - difference_type(r.i); }
+
+    inline bool operator==(const basic_iterator& r) const noexcept
+    { return i == r.i; }
+    inline bool operator!=(const basic_iterator& r) const noexcept
+    { return i != r.i; }
+    inline bool operator< (const basic_iterator& r) const noexcept
+    { return i <  r.i; }
+    inline bool operator> (const basic_iterator& r) const noexcept
+    { return i >  r.i; }
+    inline bool operator<=(const basic_iterator& r) const noexcept
+    { return i <= r.i; }
+    inline bool operator>=(const basic_iterator& r) const noexcept
+    { return i >= r.i; }
+
+    inline size_type index() const noexcept { return i; }
+  };
+
+public:
+  using iterator = basic_iterator;
+  using const_iterator = basic_iterator;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  sparse_container(): _bins(), _size(0) { }
+  explicit sparse_container(size_type n): _bins(), _size(n) { }
+
+  inline value_type& operator[](size_type i) { return _bins[i]; }
+  inline const value_type& operator[](size_type i) const { return get(i); }
+  inline const value_type& get(size_type i) const {
+    const auto it = _bins.find(i);
+    return it==_bins.end() ? empty_bin() : it->second;
+  }
+
+  inline size_type size() const noexcept { return _size; }
+  inline size_type nfilled() const noexcept { return _bins.size(); }
+  inline bool is_filled(size_type i) const { return _bins.count(i); }
+  inline const map_type& map() const noexcept { return _bins; }
+
+  inline const_iterator begin() const noexcept { return { this, 0 }; }
+  inline const_iterator   end() const noexcept { return { this, _size }; }
+  inline const_reverse_iterator rbegin() const noexcept
+  { return const_reverse_iterator(end()); }
+  inline const_reverse_iterator   rend() const noexcept
+  { return const_reverse_iterator(begin()); }
+
+  // allocated bins, sorted by index
+  using filled_type = std::pair<size_type,const value_type*>;
+  std::vector<filled_type> filled() const {
+    return filled_impl<filled_type>(_bins);
+  }
+  using mutable_filled_type = std::pair<size_type,value_type*>;
+  std::vector<mutable_filled_type> filled() {
+    return filled_impl<mutable_filled_type>(_bins);
+  }
+
+  // only allocates bins filled in r
+  sparse_container& operator+=(const sparse_container& r) {
+    for (const auto& b : r._bins) _bins[b.first] += b.second;
+    return *this;
+  }
+
+  inline void clear() { _bins.clear(); }
+};
+
+// Overload for containers that can add without visiting every bin
+template <typename Bin>
+inline void add_bins(sparse_container<Bin>& a, const sparse_container<Bin>& b)
+{ a += b; }
+
+// Running sums along an axis, as integrate_bins in binner.hh
+// Each line along the axis is summed from its first filled bin on.
+template <typename Bin>
+void integrate_bins(sparse_container<Bin>& bins,
+  axis_size_type nb, axis_size_type n, axis_size_type na, bool right
+) {
+  if (!nb || n < 2 || !na) return;
+  // first filled index along the axis, by line
+  std::map<axis_size_type,axis_size_type> lines;
+  for (const auto& b : bins.map()) {
+    const axis_size_type i = b.first / nb % n,
+      line = b.first % nb + nb * (b.first / (nb*n));
+    const auto it = lines.emplace(line,i).first;
+    if (right ? i < it->second : i > it->second) it->second = i;
+  }
+  for (const auto& l : lines) {
+    const axis_size_type b = l.first % nb, a = l.first / nb;
+    auto index = [=](axis_size_type i){ return b + nb*(i + n*a); };
+    Bin* prev = &bins[index(l.second)];
+    if (right) for (axis_size_type i=l.second+1; i<n; ++i) {
+      Bin& it = bins[index(i)];
+      it += *prev;
+      prev = &it;
+    } else for (axis_size_type i=l.second; i; ) {
+      Bin& it = bins[index(--i)];
+      it += *prev;
+      prev = &it;
+    }
+  }
+}
+
+} // end namespace ivanp
+
+#endif
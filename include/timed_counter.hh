@@ -4,9 +4,17 @@
 #define IVANP_TIMED_COUNTER_CHRONO_HH
 
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdio>
+#include <functional>
 
 #if __has_include(<unistd.h>)
 #include <unistd.h>
@@ -20,47 +28,64 @@ protected:
   virtual std::string do_grouping() const { return "\03"; }
 };
 
-template <typename CntType, typename Compare = std::less<CntType>>
-class timed_counter {
-  static_assert( std::is_integral<CntType>::value,
-    "Cannot instantiate timed_counter of non-integral type");
+// Progress display shared by the counters ==========================
+// If the TIMED_COUNTER_HEARTBEAT environment variable is set, every
+// printout also rewrites that file with a one line JSON summary:
+// {"count":,"total":,"fraction":,"elapsed":,"rate":,"eta":}
+// with times in seconds and rate in counts per second.
+
+class progress_printer {
 public:
-  using value_type   = CntType;
-  using compare_type = Compare;
-  using clock_type   = std::chrono::system_clock;
-  using time_type    = std::chrono::time_point<clock_type>;
-  using sec_type     = std::chrono::duration<double>;
-  using ms_type      = std::chrono::duration<double,std::milli>;
+  using clock_type = std::chrono::steady_clock;
+  using time_type  = std::chrono::time_point<clock_type>;
+  using sec_type   = std::chrono::duration<double>;
+  using ms_type    = std::chrono::duration<double,std::milli>;
 
 private:
-  value_type cnt, cnt_start, cnt_end;
-  time_type start = clock_type::now(), last = start;
+  time_type start;
   int nb = 30;
-  compare_type cmp;
 
-  static const std::locale cnt_locale;
+  static const std::locale& cnt_locale() {
+    static const std::locale loc(std::locale(), new comma_numpunct());
+    return loc;
+  }
 
 public:
-  void print() {
+  static const char* heartbeat_file() {
+    static const char* name = std::getenv("TIMED_COUNTER_HEARTBEAT");
+    return name;
+  }
+
+  progress_printer(): start(clock_type::now()) { }
+
+  void reset() {
+    start = clock_type::now();
+    nb = 30;
+  }
+
+  inline time_type start_time() const noexcept { return start; }
+
+  template <typename T>
+  void print(T cnt, T cnt_start, T cnt_end, time_type now) {
     using std::cout;
     using std::setw;
     using std::setfill;
     std::ios::fmtflags f(cout.flags());
     auto prec = cout.precision();
 
-    const auto dt = sec_type((last = clock_type::now()) - start).count();
+    const auto dt = sec_type(now - start).count();
     const int hours   = dt/3600;
     const int minutes = (dt-hours*3600)/60;
     const int seconds = (dt-hours*3600-minutes*60);
+    const double frac = cnt==cnt_start ? 0.
+      : double(cnt-cnt_start)/double(cnt_end-cnt_start);
 
     std::stringstream cnt_ss;
-    cnt_ss.imbue(cnt_locale);
+    cnt_ss.imbue(cnt_locale());
     cnt_ss << setw(14) << cnt;
     cout << cnt_ss.rdbuf() << " | ";
     cout.precision(2);
-    cout << std::fixed << setw(6) << (
-      cnt==cnt_start ? 0. : 100.*float(cnt-cnt_start)/float(cnt_end-cnt_start)
-    ) <<'%'<< " | ";
+    cout << std::fixed << setw(6) << 100.*frac <<'%'<< " | ";
     if (hours) {
       if (nb<38) nb = 38;
       cout << setw(5) << hours << ':'
@@ -73,7 +98,7 @@ public:
     } else if (seconds) {
       cout << setw(2) << seconds << 's';
     } else {
-      cout << int(ms_type(clock_type::now() - start).count()) << "ms";
+      cout << int(ms_type(now - start).count()) << "ms";
     }
 
 #if __has_include(<unistd.h>)
@@ -87,9 +112,71 @@ public:
 #endif
     cout.flags(f);
     cout.precision(prec);
+
+    if (heartbeat_file()) heartbeat(cnt-cnt_start, cnt_end-cnt_start, dt);
+  }
+
+  // write to a temporary file and rename, so readers never see
+  // a partially written file
+  template <typename T>
+  static void heartbeat(T n, T total, double dt) {
+    const std::string name = heartbeat_file(), tmp = name + ".tmp";
+    const double rate = dt > 0 ? n/dt : 0.;
+    std::ofstream f(tmp);
+    f.precision(6);
+    f << "{\"count\":" << n
+      << ",\"total\":" << total
+      << ",\"fraction\":" << (total ? double(n)/double(total) : 0.)
+      << ",\"elapsed\":" << dt
+      << ",\"rate\":" << rate
+      << ",\"eta\":" << (rate > 0 && total > n ? (total-n)/rate : 0.)
+      << "}\n";
+    f.close();
+    std::rename(tmp.c_str(),name.c_str());
+  }
+};
+
+// Single thread counter ============================================
+// The clock is only read once every `stride` increments. The stride
+// adapts so that the clock is read roughly every 10 to 100 ms,
+// which keeps the cost per increment to a decrement and a branch.
+
+template <typename CntType, typename Compare = std::less<CntType>>
+class timed_counter {
+  static_assert( std::is_integral<CntType>::value,
+    "Cannot instantiate timed_counter of non-integral type");
+public:
+  using value_type   = CntType;
+  using compare_type = Compare;
+  using clock_type   = progress_printer::clock_type;
+  using time_type    = progress_printer::time_type;
+  using sec_type     = progress_printer::sec_type;
+
+  static constexpr unsigned max_stride = 1u << 20;
+
+private:
+  value_type cnt, cnt_start, cnt_end;
+  progress_printer printer;
+  time_type last = printer.start_time(), last_check = last;
+  unsigned stride = 1, until_check = 1;
+  compare_type cmp;
+
+  void print(time_type now) {
+    last = now;
+    printer.print(cnt,cnt_start,cnt_end,now);
   }
+
+public:
+  void print() { print(clock_type::now()); }
   void print_check() {
-    if ( sec_type(clock_type::now()-last).count() > 1 ) print();
+    if (--until_check) return;
+    const auto now = clock_type::now();
+    const double dt = sec_type(now - last_check).count();
+    last_check = now;
+    if (dt < 0.01) { if (stride < max_stride) stride <<= 1; }
+    else if (dt > 0.1) { if (stride > 1) stride >>= 1; }
+    until_check = stride;
+    if ( sec_type(now - last).count() > 1 ) print(now);
   }
 
   timed_counter(): cnt(0), cnt_start(0), cnt_end(0) { }
@@ -103,9 +190,11 @@ public:
     cnt = i;
     cnt_start = i;
     cnt_end = n;
-    start = clock_type::now();
-    last = start;
-    nb = 30;
+    printer.reset();
+    last = printer.start_time();
+    last_check = last;
+    stride = 1;
+    until_check = 1;
   }
   inline void reset(value_type n) { reset(0,n); }
 
@@ -153,8 +242,90 @@ public:
 };
 
 template <typename T, typename L>
-const std::locale timed_counter<T,L>::cnt_locale(
-  std::locale(), new comma_numpunct() );
+constexpr unsigned timed_counter<T,L>::max_stride;
+
+// Multi-thread counter =============================================
+// One display for several worker threads. Each worker increments its
+// own local() counter, which adds to the shared total every
+// local_stride counts and when it is destroyed. A separate thread
+// prints the total once per second.
+//
+//   parallel_timed_counter<Long64_t> cnt(nentries);
+//   #pragma omp parallel
+//   {
+//     auto c = cnt.local();
+//     for (...) { ...; ++c; }
+//   }
+
+template <typename CntType>
+class parallel_timed_counter {
+  static_assert( std::is_integral<CntType>::value,
+    "Cannot instantiate parallel_timed_counter of non-integral type");
+public:
+  using value_type = CntType;
+  using clock_type = progress_printer::clock_type;
+
+  static constexpr value_type local_stride = 1 << 10;
+
+  class local_counter {
+    parallel_timed_counter* p;
+    value_type n = 0;
+  public:
+    local_counter(parallel_timed_counter* p): p(p) { }
+    local_counter(const local_counter&) = delete;
+    local_counter(local_counter&& r): p(r.p), n(r.n) { r.n = 0; }
+    ~local_counter() { flush(); }
+
+    inline void flush() noexcept {
+      if (n) p->cnt.fetch_add(n,std::memory_order_relaxed);
+      n = 0;
+    }
+    inline local_counter& operator++() noexcept {
+      if (++n == local_stride) flush();
+      return *this;
+    }
+    template <typename T>
+    inline local_counter& operator+=(T i) noexcept {
+      n += i;
+      if (n >= local_stride) flush();
+      return *this;
+    }
+  };
+
+private:
+  std::atomic<value_type> cnt;
+  value_type cnt_end;
+  progress_printer printer;
+  std::mutex mx;
+  std::condition_variable cv;
+  bool done = false;
+  std::thread display;
+
+public:
+  parallel_timed_counter(value_type n)
+  : cnt(0), cnt_end(n), display([this]{
+      std::unique_lock<std::mutex> lock(mx);
+      for (;;) {
+        printer.print(value_type(cnt),value_type(0),cnt_end,clock_type::now());
+        if (cv.wait_for(lock,std::chrono::seconds(1),[this]{ return done; }))
+          break;
+      }
+    }) { }
+  ~parallel_timed_counter() {
+    { std::lock_guard<std::mutex> lock(mx);
+      done = true; }
+    cv.notify_all();
+    display.join();
+    printer.print(value_type(cnt),value_type(0),cnt_end,clock_type::now());
+    std::cout << std::endl;
+  }
+
+  inline local_counter local() { return { this }; }
+  inline value_type count() const noexcept { return cnt; }
+};
+
+template <typename T>
+constexpr T parallel_timed_counter<T>::local_stride;
 
 } // end namespace
 
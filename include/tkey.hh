@@ -62,4 +62,23 @@ inline bool inherits_from(const TClass* c) {
   return c->InheritsFrom(T::Class());
 }
 
+#ifdef ROOT_TDirectory
+// Lazy reading of dir and its subdirectories
+// Keys are selected by class T and by filter(name) from the key headers,
+// and only the selected objects are read, then passed to f(obj,key).
+// Ownership of each object passes to f.
+template <typename T, typename Filter, typename F>
+void read_keys(TDirectory* dir, Filter&& filter, F&& f) {
+  for (TKey& key : get_keys(dir)) {
+    const TClass* key_class = get_class(key);
+    if (inherits_from<T>(key_class)) {
+      if (filter(key.GetName()))
+        if (T* obj = key_cast<T>(key)) f(obj,key);
+    } else if (inherits_from<TDirectory>(key_class)) {
+      read_keys<T>(key_cast<TDirectory>(key),filter,f);
+    }
+  }
+}
+#endif
+
 #endif
@@ -16,14 +16,35 @@ do
 
 all_fits=()
 
+if $use_unweighted; then
+  suf=unw
+else
+  suf=full
+fi
+
+# all npar fits of this range are done by one process
+if $do_fit; then
+  configs=fits_${suf}_${r}.configs
+  for p in 3 4
+  do
+    echo "fits_${suf}_${p}_${r}.root -n${p}"
+  done > $configs
+  if $use_unweighted; then
+    ./bin/fit data/H1j_mtop_unweighted.root --configs $configs -j2 \
+      -M 12:250:550 -r 0.${r} --use-chi2-pars -l 2:2:2
+  else
+    ./bin/fit ../bh_analysis2/H1j_angles.root --configs $configs -j2 \
+      -M 12:250:550 -r 0.${r} --use-chi2-pars --nbins=50
+      # -M 30:250:550 -r 0.${r} --use-chi2-pars
+  fi
+fi
+
 for p in 3 4
 do
 
 if $use_unweighted; then
-  suf=unw
   y="0:2"
 else
-  suf=full
   case "$r" in
     5) y="0.35:0.8" ;;
     8) y="0.25:1.25" ;;
@@ -34,17 +55,6 @@ fi
 fits=fits_${suf}_${p}_${r}.root
 all_fits+=($fits)
 
-if $do_fit; then
-  if $use_unweighted; then
-    ./bin/fit data/H1j_mtop_unweighted.root -o $fits \
-      -M 12:250:550 -n${p} -r 0.${r} --use-chi2-pars -l 2:2:2
-  else
-    ./bin/fit ../bh_analysis2/H1j_angles.root -o $fits \
-      -M 12:250:550 -n${p} -r 0.${r} --use-chi2-pars --nbins=50
-      # -M 30:250:550 -n${p} -r 0.${r} --use-chi2-pars
-  fi
-fi
-
 ./bin/draw $fits -y$y
 
 pars=pars_${suf}_${p}_${r}.root
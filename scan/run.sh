@@ -8,10 +8,20 @@ phi=${1:?}
 data=/msu/data/t3work2/ivanp/H1j_cos_theta.root
 # data=/home/ivanp/work/angles_hj/data/H1j_mtop_unweighted.root
 
+# binned events shared by the jobs on this node, in shared memory
+# Every job holds a shared lock while it runs, the last one to exit
+# gets the exclusive lock and removes the store.
+shm=/dev/shm/angles_hj-$USER
+exec 9>$shm.lock
+flock -s 9
+mkdir -p $shm
+trap 'flock -xn 9 && rm -rf $shm' EXIT
+
 /home/ivanp/work/angles_hj/bin/fit $data \
   -o ${phi}.root \
   -M 12:250:550 -p 0:0:0:${phi} \
-  -n 3 -r 0.8 --use-chi2-pars --nbins=50
+  -n 3 -r 0.8 --use-chi2-pars --nbins=50 \
+  --shared $shm
 
 /home/ivanp/work/angles_hj/bin/draw \
   ${phi}.root -o ${phi}.pdf -y 0.25:1.25
@@ -11,6 +11,11 @@ for arg in sys.argv[1:]:
     print(arg)
     f = TFile(arg)
     phi = float(re.sub(r"\.root$","",arg))
+    t = f.Get("fit_results")
+    if t: # typed results table
+        for row in t:
+            d[(row.lo,row.hi)][phi] = row.logl
+        continue
     for h in f.GetListOfKeys():
         h = h.ReadObj()
         name = h.GetName()
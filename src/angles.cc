@@ -1,5 +1,6 @@
 #include <iostream>
 #include <array>
+#include <vector>
 
 #include <TFile.h>
 #include <TTree.h>
@@ -8,7 +9,8 @@
 #include "timed_counter.hh"
 #include "tc_msg.hh"
 #include "math.hh"
-#include "lorentz_vector.hh"
+#include "kernels.hh"
+#include "prof.hh"
 
 using std::cout;
 using std::cerr;
@@ -22,6 +24,7 @@ inline void write(const char* name, Args&&... args) {
 }
 
 int main(int argc, char* argv[]) {
+  const char* isa_name = nullptr;
   const char *ifname, *ofname;
   std::array<double,2> Hj_mass_range;
 
@@ -31,11 +34,14 @@ int main(int argc, char* argv[]) {
         (ifname,'i',"input file",req(),pos())
         (ofname,'o',"output file",req())
         (Hj_mass_range,{"-m","--mass"},"Hj mass range",req())
+        (isa_name,"--isa","kernels ISA: generic, sse4.2, avx2, avx512\n"
+         "default: $ANGLES_ISA, else the best supported")
         .parse(argc,argv,true)) return 0;
   } catch (const std::exception& e) {
     cerr << e << endl;
     return 1;
   }
+  cpu::init(isa_name); // logs the kernels ISA at startup
 
   TFile fin(ifname);
   info("Input  file",fin.GetName());
@@ -61,29 +67,56 @@ int main(int argc, char* argv[]) {
   tout->Branch("cos_theta",&cos_theta);
   tout->Branch("y",&y);
 
+  auto& t_read   = prof::get("read");
+  auto& t_angles = prof::get("angles");
+  auto& t_fill   = prof::get("fill");
+  auto& n_sel    = prof::get("selected");
+
+  // Events are read in blocks, and cos θ is computed for a whole block
+  constexpr unsigned block = 1<<12;
+  std::array<std::vector<double>,8> p; // Higgs t,x,y,z then jet t,x,y,z
+  const double* pp[8];
+  for (unsigned i=0; i<8; ++i) {
+    p[i].resize(block);
+    pp[i] = p[i].data();
+  }
+  std::vector<double> mass(block), cth(block);
+
+  auto process = [&](unsigned n){
+    prof::timed(t_angles,[&]{
+      kernels::cos_theta(pp,n,mass.data(),cth.data()); });
+    for (unsigned i=0; i<n; ++i) {
+      const double M = mass[i];
+      if (M < Hj_mass_range[0]) continue;
+      if (Hj_mass_range[1] <= M) continue;
+
+      cos_theta = cth[i];
+      // csc_cos_theta = 1./sin(M_PI*(cos_theta+0.5));
+      // csc_cos_theta = (asin(1./cos_theta)/M_PI)-0.5;
+      y = acos(cos_theta);
+      n_sel.add();
+      prof::timed(t_fill,[&]{ return tout->Fill(); });
+    }
+  };
+
+  unsigned n = 0;
   for (timed_counter<Long64_t> ent(tin->GetEntries()); !!ent; ++ent) {
-    tin->GetEntry(ent);
-
-    const lorentz_vector pH {E[0],px[0],py[0],pz[0]},
-                         pj {E[1],px[1],py[1],pz[1]};
-    const auto Q = pH + pj;
-    const double Q2 = Q*Q;
-    const double M = sqrt(Q2);
-
-    if (M < Hj_mass_range[0]) continue;
-    if (Hj_mass_range[1] <= M) continue;
-
-    const lorentz_vector Z {Q.z,0,0,Q.t};
-    const auto ell = ((Q*pj)/Q2)*pH - ((Q*pH)/Q2)*pj;
-
-    cos_theta = (ell*Z) / sqrt(sq(ell)*sq(Z));
-    // csc_cos_theta = 1./sin(M_PI*(cos_theta+0.5));
-    // csc_cos_theta = (asin(1./cos_theta)/M_PI)-0.5;
-    y = acos(cos_theta);
-    tout->Fill();
+    prof::timed(t_read,[&]{ return tin->GetEntry(ent); });
+    for (unsigned i=0; i<2; ++i) {
+      p[4*i  ][n] = E[i];
+      p[4*i+1][n] = px[i];
+      p[4*i+2][n] = py[i];
+      p[4*i+3][n] = pz[i];
+    }
+    if (++n == block) {
+      process(n);
+      n = 0;
+    }
   }
+  process(n);
 
   write("M range",'[',Hj_mass_range[0],',',Hj_mass_range[1],')');
 
+  prof::scope t_(prof::get("write"));
   fout.Write(0,TObject::kOverwrite);
 }
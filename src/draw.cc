@@ -1,7 +1,17 @@
 #include <iostream>
 #include <vector>
+#include <sstream>
 #include <unordered_map>
 #include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 
 #include <boost/optional.hpp>
 
@@ -28,16 +38,13 @@ using namespace ivanp;
 
 ordered_map<TH1*> hj_mass_bins;
 
+// per bin histograms have the bin in the name, e.g. "...[250,275)"
+inline bool is_bin(const char* name) { return strchr(name,'['); }
+
 void loop(TDirectory* dir) { // LOOP
-  for (TKey& key : get_keys(dir)) {
-    const TClass* key_class = get_class(key);
-    if (inherits_from<TH1>(key_class)) {
-      hj_mass_bins[strchr(key.GetName(),'[')]
-        = key_cast<TH1>(key);
-    } else if (inherits_from<TDirectory>(key_class)) { // DIR
-      loop(key_cast<TDirectory>(key));
-    }
-  }
+  read_keys<TH1>(dir,is_bin,[](TH1* h, TKey& key){
+    hj_mass_bins[strchr(key.GetName(),'[')] = h;
+  });
 }
 
 std::vector<std::string> split(const char* str, char d) {
@@ -54,71 +61,64 @@ std::vector<std::string> split(const char* str, char d) {
   return tok;
 }
 
-int main(int argc, char* argv[]) {
-  std::string ifname, ofname;
-  bool logy = false, more_logy = false;
-  boost::optional<std::array<double,2>> y_range;
-
-  try {
-    using namespace ivanp::po;
-    if (program_options()
-      (ifname,'i',"input file",req(),pos())
-      (ofname,'o',"output file")
-      (y_range,'y',"y-axis range")
-      (more_logy,"--more-logy","more y-axis log labels")
-      (logy,"--logy")
-      .parse(argc,argv,true)) return 0;
-  } catch (const std::exception& e) {
-    cerr << e << endl;
-    return 1;
+// TF1 sampled once at Npx points, as TH1::Add(TF1*) would
+struct curve {
+  std::vector<double> y;
+  double a, b, norm = 0;
+  curve(TF1& f): y(f.GetNpx()), a(f.GetXmin()), b(f.GetXmax()) {
+    const double dx = (b-a)/y.size();
+    for (unsigned i=0, n=y.size(); i<n; ++i) {
+      y[i] = f.Eval(a+(i+0.5)*dx);
+      norm += y[i];
+    }
+    norm *= dx;
   }
+  TH1* hist(double scale) const {
+    TH1 *h = new TH1D("","",y.size(),a,b);
+    for (unsigned i=0, n=y.size(); i<n; ++i)
+      h->SetBinContent(i+1,y[i]*scale);
+    return h;
+  }
+  // mean over n samples starting at i
+  double mean(unsigned i, unsigned n) const {
+    double s = 0;
+    for (unsigned j=i, e=std::min<unsigned>(i+n,y.size()); j<e; ++j) s += y[j];
+    return s/n;
+  }
+};
 
-  TFile fin(ifname.c_str());
-  info("Input file",fin.GetName());
-  if (fin.IsZombie()) return 1;
-
-  loop(&fin);
-  if (hj_mass_bins.size()==0) {
-    error("nothing to draw");
-    return 1;
-  } else info("hj_mass bins",hj_mass_bins.size());
-  hj_mass_bins.sort();
-
-  TCanvas canv("","",700,600);
-  if (logy) canv.SetLogy();
-  gStyle->SetOptStat(0);
-
-  TPad pad1("","",0,0.25,1,1);
-  pad1.SetMargin(0.05,0.05,0,0.1);
-  TPad pad2("","",0,0,1,0.25);
-  pad2.SetMargin(0.05,0.05,0.25,0);
-
+class page_painter {
+  TCanvas canv;
+  TPad pad1, pad2;
   TLatex latex;
-  latex.SetTextSize(0.025);
+  TLine line1;
+  bool more_logy;
+  boost::optional<std::array<double,2>> y_range;
 
-  if (ofname.empty()) {
-    ofname = ifname.substr(ifname.rfind('/')+1);
-    ofname = ofname.substr(0,ofname.rfind(".root"))+".pdf";
+public:
+  page_painter(bool logy, bool more_logy,
+    const boost::optional<std::array<double,2>>& y_range)
+  : canv("","",700,600),
+    pad1("","",0,0.25,1,1), pad2("","",0,0,1,0.25),
+    line1(-1,1,1,1),
+    more_logy(more_logy), y_range(y_range)
+  {
+    if (logy) canv.SetLogy();
+    pad1.SetMargin(0.05,0.05,0,0.1);
+    pad2.SetMargin(0.05,0.05,0.25,0);
+    latex.SetTextSize(0.025);
   }
-  info("Output file",ofname);
-  if (hj_mass_bins.size()>1) ofname += '(';
-  unsigned page_cnt = hj_mass_bins.size();
-  bool first_page = true;
-  TH1 *h_mc = nullptr, *h_fit = nullptr;
-  for (const auto& bin : hj_mass_bins) {
-    --page_cnt;
-    const std::string& name = bin.first;
 
+  void operator()(const std::string& name, TH1* h, const std::string& ofname) {
     pad1.cd();
 
-    TH1 *h = bin.second;
     h->SetLineWidth(2);
     h->SetTitle(cat("hj_mass #in ",name).c_str());
 
     const double scale = 1./h->Integral("width");
     h->Scale(scale);
     TAxis *ax = h->GetXaxis();
-    h_mc = new TH1D("","",h->GetNbinsX(),ax->GetXmin(),ax->GetXmax());
+    TH1 *h_mc = new TH1D("","",h->GetNbinsX(),ax->GetXmin(),ax->GetXmax());
     h_mc->Add(h);
     h_mc->SetXTitle(ax->GetTitle());
     h->SetXTitle("");
@@ -129,21 +129,16 @@ int main(int argc, char* argv[]) {
     h->Draw();
     latex.DrawLatexNDC(0.70,0.85,cat("Events: ",h->GetEntries()).c_str());
 
+    std::unique_ptr<curve> fit;
     int fi = 0;
     for (TF1& f : list_cast<TF1>(h->GetListOfFunctions())) {
-      TH1 *h = new TH1D("","",f.GetNpx(),f.GetXmin(),f.GetXmax());
-      h->Add(&f);
-      h->SetLineWidth(2);
-      h->SetLineColor(f.GetLineColor());
-
-      if (strstr(f.GetName(),"-logl")) {
-        h->Scale(1./h->Integral("width"));
-        h_fit = static_cast<TH1*>(h->Clone());
-      } else {
-        h->Scale(scale);
-      }
-
-      h->Draw("C SAME");
+      std::unique_ptr<curve> c(new curve(f));
+      const bool is_logl = strstr(f.GetName(),"-logl");
+      TH1 *hf = c->hist(is_logl ? 1./c->norm : scale);
+      hf->SetLineWidth(2);
+      hf->SetLineColor(f.GetLineColor());
+      hf->Draw("C SAME");
+      if (is_logl) fit = std::move(c);
 
       auto l = [&](double x, double y, int i){
         double a, b;
@@ -173,7 +168,6 @@ int main(int argc, char* argv[]) {
 
     pad2.cd();
     h_mc->SetTitle("");
-    h_fit->SetTitle("");
     ax = h_mc->GetXaxis();
     TAxis *ay = h_mc->GetYaxis();
     ax->SetLabelSize(0.1);
@@ -181,25 +175,162 @@ int main(int argc, char* argv[]) {
     ax->SetTitleSize(0.1);
     ax->SetTickLength(0.09);
     ay->SetTickLength(0.02);
-    const int factor = h_fit->GetNbinsX()/h_mc->GetNbinsX();
-    h_fit->Rebin(factor);
-    h_fit->Scale(1./factor);
-    h_mc->Divide(h_fit);
+    if (fit) { // MC / LogL fit, from the same samples
+      const unsigned nb = h_mc->GetNbinsX();
+      const unsigned factor = fit->y.size()/nb;
+      for (unsigned i=0; i<nb; ++i) {
+        const double d = fit->mean(i*factor,factor)/fit->norm;
+        h_mc->SetBinContent(i+1,h_mc->GetBinContent(i+1)/d);
+        h_mc->SetBinError(i+1,h_mc->GetBinError(i+1)/d);
+      }
+    }
     ay->SetRangeUser(0.95,1.05);
     h_mc->Draw();
-    static TLine line1(-1,1,1,1);
     line1.Draw();
 
     canv.cd();
     pad1.Draw();
     pad2.Draw();
 
-    if (!page_cnt && !first_page) ofname += ')';
-    canv.Print(ofname.c_str(),("Title:"+std::string(name,1,name.size()-2)).c_str());
-    if (first_page) ofname.pop_back(), first_page = false;
+    canv.Print(ofname.c_str(),
+      ("Title:"+std::string(name,1,name.size()-2)).c_str());
 
     delete h_mc;
-    delete h_fit;
   }
+};
 
+int main(int argc, char* argv[]) {
+  std::string ifname, ofname;
+  bool logy = false, more_logy = false;
+  boost::optional<std::array<double,2>> y_range;
+  unsigned njobs = 1;
+  std::string merge_cmd = "pdfunite";
+
+  try {
+    using namespace ivanp::po;
+    if (program_options()
+      (ifname,'i',"input file",req(),pos())
+      (ofname,'o',"output file")
+      (y_range,'y',"y-axis range")
+      (more_logy,"--more-logy","more y-axis log labels")
+      (logy,"--logy")
+      (njobs,{"-j","--jobs"},"draw pages in parallel processes")
+      (merge_cmd,"--merge",cat("command joining single page pdfs,\n"
+       "given the pages and then the output [",merge_cmd,"]\n"
+       "run without a shell, split at spaces"))
+      .parse(argc,argv,true)) return 0;
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
+
+  TFile fin(ifname.c_str());
+  info("Input file",fin.GetName());
+  if (fin.IsZombie()) return 1;
+
+  loop(&fin);
+  if (hj_mass_bins.size()==0) {
+    error("nothing to draw");
+    return 1;
+  } else info("hj_mass bins",hj_mass_bins.size());
+  hj_mass_bins.sort();
+
+  gStyle->SetOptStat(0);
+
+  if (ofname.empty()) {
+    ofname = ifname.substr(ifname.rfind('/')+1);
+    ofname = ofname.substr(0,ofname.rfind(".root"))+".pdf";
+  }
+  info("Output file",ofname);
+
+  std::vector<std::pair<std::string,TH1*>> pages;
+  for (const auto& bin : hj_mass_bins) pages.emplace_back(bin);
+  const unsigned npages = pages.size();
+  if (njobs > npages) njobs = npages;
+
+  page_painter paint(logy, more_logy, y_range);
+
+  if (njobs < 2) { // one multi-page pdf -----------------------------
+    for (unsigned i=0; i<npages; ++i) {
+      std::string name = ofname;
+      if (npages>1) {
+        if (i==0) name += '(';
+        else if (i+1==npages) name += ')';
+      }
+      paint(pages[i].first,pages[i].second,name);
+    }
+    return 0;
+  }
+
+  // Pages are drawn by worker processes into single page files,
+  // which are then joined in order
+  const std::string dir = ofname + ".pages";
+  if (mkdir(dir.c_str(),0755) && errno!=EEXIST) {
+    cerr << error("cannot create ",dir,": ",strerror(errno)) << endl;
+    return 1;
+  }
+  auto page_name = [&](unsigned i){ return cat(dir,'/',i,".pdf"); };
+
+  info("Workers",njobs);
+  cout.flush();
+  std::vector<pid_t> workers;
+  for (unsigned k=0; k<njobs; ++k) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+      cerr << error("fork failed: ",strerror(errno)) << endl;
+      return 1;
+    }
+    if (pid == 0) {
+      for (unsigned i=k; i<npages; i+=njobs)
+        paint(pages[i].first,pages[i].second,page_name(i));
+      cout.flush();
+      _exit(0);
+    }
+    workers.push_back(pid);
+  }
+  bool ok = true;
+  for (pid_t pid : workers) {
+    int status;
+    waitpid(pid,&status,0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status)==0;
+  }
+  if (!ok) {
+    cerr << error("a worker failed, pages are left in ",dir) << endl;
+    return 1;
+  }
+
+  // run without a shell: the words of merge_cmd, the pages, the output
+  std::vector<std::string> args;
+  { std::istringstream ss(merge_cmd);
+    for (std::string a; ss >> a; ) args.push_back(a);
+  }
+  if (args.empty()) {
+    cerr << error("empty merge command") << endl;
+    return 1;
+  }
+  for (unsigned i=0; i<npages; ++i) args.push_back(page_name(i));
+  args.push_back(ofname);
+  std::vector<char*> cmd;
+  for (auto& a : args) cmd.push_back(&a[0]);
+  cmd.push_back(nullptr);
+  info("Joining pages",merge_cmd);
+  cout.flush();
+  const pid_t pid = fork();
+  if (pid < 0) {
+    cerr << error("fork failed: ",strerror(errno)) << endl;
+    return 1;
+  }
+  if (pid == 0) {
+    execvp(cmd[0],cmd.data());
+    cerr << error("cannot run ",cmd[0],": ",strerror(errno)) << endl;
+    _exit(127);
+  }
+  int status;
+  waitpid(pid,&status,0);
+  if (!(WIFEXITED(status) && WEXITSTATUS(status)==0)) {
+    cerr << error("failed: ",merge_cmd,", pages are left in ",dir) << endl;
+    return 1;
+  }
+  for (unsigned i=0; i<npages; ++i) std::remove(page_name(i).c_str());
+  rmdir(dir.c_str());
 }
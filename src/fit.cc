@@ -1,7 +1,19 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <array>
 #include <vector>
 #include <tuple>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <TFile.h>
 #include <TTree.h>
@@ -16,6 +28,13 @@
 #include "binner.hh"
 #include "math.hh"
 #include "Legendre.hh"
+#include "kernels.hh"
+#include "fit_results.hh"
+#include "hj_fit.hh"
+#include "fit_cache.hh"
+#include "event_store.hh"
+#include "column_store.hh"
+#include "prof.hh"
 
 #define _STR(S) #S
 #define STR(S) _STR(S)
@@ -26,68 +45,89 @@ using std::endl;
 using namespace ivanp;
 using namespace ivanp::math;
 
-unsigned nbins = 100;
 double weight = 1., hj_mass, cos_theta;
-double fit_scale = 1.;
-
-struct wx { double w, x; };
-struct mass_bin {
-  std::vector<wx> v;
-  TH1D * const h;
-  mass_bin(): v(), h(new TH1D("","",nbins,-1.,1.)) { v.reserve(1024); }
-  inline void operator()() {
-    cos_theta *= fit_scale;
-    if (std::abs(cos_theta)>1.) return;
-    v.push_back({weight,cos_theta});
-    h->Fill(cos_theta,weight);
-  }
-  inline auto begin() const noexcept { return v.begin(); }
-  inline auto   end() const noexcept { return v.  end(); }
-};
+
+spill_budget* spill = nullptr; // arenas go to disk above it, if set
+
+// LogL fit to cos θ and weights rounded to float, summed in double.
+// With a float_check tolerance > 0 every fit is repeated in double
+// precision and fails if -2LogL, or a parameter in units of its error,
+// differs by more.
+bool float_events = false;
+double float_check_logl = 0, float_check_pars = 0;
+
+inline bool float_check() noexcept {
+  return float_events && (float_check_logl > 0 || float_check_pars > 0);
+}
+
+using bin_events = event_store::bin_view;
 
 #define NPAR 4
 const char* pars_names[NPAR] = {"c2","c4","c6","#phi2"};
 
-int main(int argc, char* argv[]) {
-  const char *ifname, *ofname;
+unsigned par_index(const std::string& name) {
+  for (unsigned i=0; i<NPAR; ++i)
+    if (name==pars_names[i] || name==pars_names[i]+(pars_names[i][0]=='#'))
+      return i;
+  throw error("unknown parameter ",name);
+}
+
+struct fit_config {
+  std::string ofname;
   unsigned npar = NPAR;
-  std::array<double,NPAR> pars_init{0,0,0,0};
-  std::tuple<unsigned,double,double> hj_mass_binning;
   double fit_range = 1.;
-  int print_level = 0;
+  std::array<double,NPAR> pars_init {{0,0,0,0}};
+  unsigned fixed = 0; // bit i fixes parameter i
   bool use_chi2_pars = false;
+  unsigned nbins = 100;
 
-  try {
+  inline bool is_fixed(unsigned i) const noexcept {
+    return i >= npar || (fixed >> i & 1u);
+  }
+
+  void check() const {
+    if (npar>NPAR) throw error("npar > " STR(NPAR));
+    if (!(0. < fit_range && fit_range <= 1.))
+      throw error("fit range not in (0,1]");
+  }
+
+  // A line of the --configs file: output file name, then fit options,
+  // which override the ones given on the command line
+  void parse(const std::string& line) {
+    std::vector<std::string> args { "fit" };
+    { std::istringstream ss(line);
+      ss >> ofname;
+      for (std::string arg; ss >> arg; ) args.push_back(arg);
+    }
+    std::vector<const char*> argv;
+    for (const auto& a : args) argv.push_back(a.c_str());
+    std::vector<std::string> fix;
     using namespace ivanp::po;
-    if (program_options()
-        (ifname,'i',"input file",req(),pos())
-        (ofname,'o',"output file",req())
-        (hj_mass_binning,'M',"Higgs+jet mass binning",req())
-        (npar,'n',cat("number of fit parameters [",npar,']'))
-        (fit_range,'r',cat("max cosθ fit range [",fit_range,']'))
-        (pars_init,'p',"parameters' initial values")
-        (use_chi2_pars,"--use-chi2-pars")
-        (nbins,"--nbins",cat('[',nbins,']'))
-        (print_level,"--print-level",
-         "-1 - quiet (also suppress all warnings)\n"
-         " 0 - normal (default)\n"
-         " 1 - verbose")
-        .parse(argc,argv,true)) return 0;
-    if (npar>NPAR) throw std::runtime_error("npar > " STR(NPAR));
-    if (fit_range > 1.) throw std::runtime_error("fit range > 1");
-  } catch (const std::exception& e) {
-    cerr << e << endl;
-    return 1;
+    program_options()
+      (npar,'n',"number of fit parameters")
+      (fit_range,'r',"max cosθ fit range")
+      (pars_init,'p',"parameters' initial values")
+      (fix,"--fix","fixed parameters")
+      (use_chi2_pars,"--use-chi2-pars")
+      (nbins,"--nbins")
+      .parse(argv.size(),argv.data());
+    for (const auto& name : fix) fixed |= 1u << par_index(name);
   }
-  fit_scale = 1./fit_range;
+};
 
+// Read the angles tree into mass bins of an arena
+// A first pass over the hj_mass branch counts the events of every bin.
+bool read_angles(
+  const char* ifname, const uniform_axis<double>& axis,
+  event_store::arena& hj_mass_bins
+) {
   TFile fin(ifname);
   info("Input file",fin.GetName());
-  if (fin.IsZombie()) return 1;
+  if (fin.IsZombie()) return false;
 
   TTree *tin;
   fin.GetObject("angles",tin);
-  if (!tin) return 1;
+  if (!tin) return false;
 
   tin->SetBranchAddress("hj_mass",&hj_mass);
   tin->SetBranchAddress("cos_theta",&cos_theta);
@@ -98,123 +138,467 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  TH1::AddDirectory(false);
-
-  TFile fout(ofname,"recreate");
-  info("Output file",fout.GetName());
-  if (fout.IsZombie()) return 1;
-  fout.cd();
-
-  binner<mass_bin, std::tuple<
-    axis_spec<uniform_axis<double>, false, false> >
-  > hj_mass_bins(hj_mass_binning);
+  const unsigned nbins = axis.nbins();
+  auto bin_of = [&](double m) -> unsigned { // nbins if outside
+    const unsigned b = axis.find_bin(m);
+    return (b==0 || b>nbins) ? nbins : b-1;
+  };
+  const Long64_t nent = tin->GetEntries();
+  hj_mass_bins = event_store::arena(nbins);
+
+  // count LOOP =====================================================
+  prof::timed(prof::get("count"),[&]{
+    TBranch *b_mass = tin->GetBranch("hj_mass");
+    for (Long64_t ent=0; ent<nent; ++ent) {
+      b_mass->GetEntry(ent);
+      const unsigned b = bin_of(hj_mass);
+      if (b < nbins) hj_mass_bins.count(b);
+    }
+  });
+  try {
+    hj_mass_bins.allocate(spill);
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return false;
+  }
 
   // tree LOOP ======================================================
-  for (timed_counter<Long64_t> ent(tin->GetEntries()); !!ent; ++ent) {
-    tin->GetEntry(ent);
-    hj_mass_bins(hj_mass);
-    // if (ent > 1e6) break;
+  auto& t_read = prof::get("read");
+  auto& t_fill = prof::get("fill");
+  for (timed_counter<Long64_t> ent(nent); !!ent; ++ent) {
+    prof::timed(t_read,[&]{ return tin->GetEntry(ent); });
+    prof::scope t_(t_fill);
+    const unsigned b = bin_of(hj_mass);
+    if (b < nbins) hj_mass_bins.push(b,cos_theta,weight);
   }
+  return true;
+}
 
-  const std::array<std::array<double,2>,NPAR> limits {{
-    {-1e-4,2.}, {0.,0.}, {0.,0.}, {-1e-4,M_PI}
-  }};
+// Fit every mass bin with one configuration and write cfg.ofname
+bool fit_bins(
+  const fit_config& cfg, const uniform_axis<double>& axis,
+  const std::vector<bin_events>& hj_mass_bins,
+  const std::array<std::array<double,2>,NPAR>& limits,
+  fit_cache::cache& cache, int print_level
+) {
+  TFile fout(cfg.ofname.c_str(),"recreate");
+  info("Output file",fout.GetName());
+  if (fout.IsZombie()) return false;
+  fout.cd();
+
+  const unsigned nbins = cfg.nbins, npar = cfg.npar;
+  const double fit_range = cfg.fit_range, fit_scale = 1./fit_range;
+  const auto& pars_init = cfg.pars_init;
+  const bool use_chi2_pars = cfg.use_chi2_pars;
 
   TF1 *fit = new TF1("fit-logl",Legendre,-1.,1.,NPAR);
   fit->SetLineColor(2);
   for (unsigned i=0; i<NPAR; ++i)
     fit->SetParName(i,pars_names[i]);
-  for (unsigned i=npar; i<NPAR; ++i)
-    fit->FixParameter(i,pars_init[i]);
-
-  TF1 *fit2 = new TF1("fit-chi2",
-    [](const double* x, const double* c){ return c[0]*Legendre(x,c+1); },
-    -1.,1.,NPAR+1);
-  fit2->SetLineColor(418);
-  fit2->SetParName(0,"A");
-  for (unsigned i=0; i<NPAR; ++i) {
-    fit2->SetParName(i+1,pars_names[i]);
-    fit2->SetParameter(i+1,pars_init[i]);
-    fit2->SetParLimits(i+1,limits[i][0],limits[i][1]);
-  }
-  for (unsigned i=npar; i<NPAR; ++i)
-    fit2->FixParameter(i+1,pars_init[i]);
+  for (unsigned i=0; i<NPAR; ++i)
+    if (cfg.is_fixed(i)) fit->FixParameter(i,pars_init[i]);
 
-  if (nbins<100) {
-    const int n = ceil(91./nbins)*nbins;
-    fit ->SetNpx(n);
-    fit2->SetNpx(n);
-  }
+  // the χ² fit is the one of the pipeline and fit_server
+  hj::fit_options opt;
+  opt.npar = npar;
+  opt.fixed = cfg.fixed;
+  opt.init = pars_init;
+  opt.limits = limits;
+  opt.nbins = nbins;
+  opt.print_level = print_level;
+  TF1 *fit2 = hj::chi2_function(opt);
+
+  if (nbins<100) fit->SetNpx(fit2->GetNpx());
 
   // Fit in mass bins ===============================================
   double pars[NPAR], errs[NPAR];
+  hj::fit_results_writer results;
 
-  for (const auto& bin : hj_mass_bins) {
-    static unsigned bin_i = 0;
-    const std::string hj_mass_bin = hj_mass_bins.bin_str(++bin_i);
+  unsigned bin_i = 0;
+  for (const auto& events : hj_mass_bins) {
+    const std::string hj_mass_bin = bin_str(axis,++bin_i);
     info("Fitting hj_mass",hj_mass_bin);
-    info("Events",bin.v.size());
-
-    bin.h->SetName(("cos_theta-hj_mass"+hj_mass_bin).c_str());
-    bin.h->SetTitle(("hj_mass "+hj_mass_bin).c_str());
-    bin.h->SetXTitle(cat("cos #theta / ",fit_range).c_str());
-
-    auto LogL = [&v=bin.v](const double* c) -> double {
-      long double logl = 0.;
-      const unsigned n = v.size();
-      #pragma omp parallel for reduction(+:logl)
-      for (unsigned i=0; i<n; ++i)
-        logl += v[i].w*log(Legendre(&v[i].x,c));
-      return -2.*logl;
+    if (bin_i < hj_mass_bins.size())
+      event_store::prefetch(hj_mass_bins[bin_i]);
+
+    // cos θ scaled to the fit range, counted first to size the arrays
+    size_t nev = 0;
+    for (size_t i=0, n=events.size(); i<n; ++i)
+      nev += !(std::abs(events.x[i]*fit_scale)>1.);
+    event_store::arena bin(1);
+    std::vector<float> xf, wf; // with float_events
+    const bool doubles = !float_events || float_check();
+    if (doubles) bin.count(0,nev);
+    bin.allocate(spill);
+    if (float_events) {
+      xf.reserve(nev);
+      wf.reserve(nev);
+    }
+    for (size_t i=0, n=events.size(); i<n; ++i) {
+      const double x = events.x[i]*fit_scale;
+      if (std::abs(x)>1.) continue;
+      if (doubles) bin.push(0,x,events.w[i]);
+      if (float_events) {
+        xf.push_back(x);
+        wf.push_back(events.w[i]);
+      }
+    }
+    const bin_events ev = bin.view(0);
+    info("Events",nev);
+
+    TH1D *h = new TH1D(("cos_theta-hj_mass"+hj_mass_bin).c_str(),
+      ("hj_mass "+hj_mass_bin).c_str(), nbins,-1.,1.);
+    h->SetXTitle(cat("cos #theta / ",fit_range).c_str());
+    if (doubles) hj::fill_cos_hist(h,ev.n,ev.x,ev.w);
+    else hj::fill_cos_hist(h,nev,xf.data(),wf.data());
+
+    auto& t_logl = prof::get("logl "+hj_mass_bin);
+    auto LogL = [&](const double* c) -> double {
+      prof::scope t_(t_logl);
+      return float_events
+        ? kernels::logl(xf.data(),wf.data(),nev,c)
+        : kernels::logl(ev.x,ev.w,nev,c);
+    };
+    auto LogL_double = [ev,&t_logl](const double* c) -> double {
+      prof::scope t_(t_logl);
+      return kernels::logl(ev.x,ev.w,ev.n,c);
     };
 
-    info("χ² fit");
-    fit2->SetParameter(0,bin.h->Integral(1,bin.h->GetNbinsX()+1));
-    auto result = bin.h->Fit(fit2,"SR0V");
-    TF1 *f = static_cast<TF1*>(bin.h->GetListOfFunctions()->At(0));
-    f->SetTitle(cat(
-        std::setprecision(15),std::scientific,
-        "#chi^{2} = ",result->Chi2(),","
-        "-2LogL = ",LogL(fit2->GetParameters()+1)
-      ).c_str());
-    // f->SetParameter(4, npar>3 ? mod_phi(f->GetParameter(4)) : 0.);
-
-    info("LogL fit");
-    minuit<decltype(LogL)> m(NPAR,LogL);
-    m.SetPrintLevel(print_level);
-
-    for (unsigned i=0; i<NPAR; ++i)
-      m.DefineParameter(
-        i,             // parameter number
-        pars_names[i], // parameter name
-        use_chi2_pars ? f->GetParameter(i+1) : pars_init[i],  // start value
-        0.01,          // step size
-        limits[i][0],  // mininum
-        limits[i][1]   // maximum
-      );
-
-    switch (npar) {
-      case 0: m.FixParameter(0);
-      case 1: m.FixParameter(1);
-      case 2: m.FixParameter(2);
-      case 3: m.FixParameter(3);
-      default: break;
+    hj::fit_row row { axis.lower(bin_i).get(), axis.upper(bin_i).get(),
+                      int(opt.nfree()) };
+    row.events = nev;
+    std::array<double,NPAR+1> chi2_pars, chi2_errs; // as in fit2, A first
+    double chi2_logl; // -2LogL at chi2_pars
+
+    std::string key;
+    if (cache) {
+      fit_cache::hasher hash;
+      hash(fit_cache::version);
+      // a cached fit passed the float check it was made with
+      if (float_events) hash(xf)(wf)(float_check_logl)(float_check_pars);
+      else hash
+        (uint64_t(ev.n)).add(ev.x,ev.n*sizeof(double))
+        (uint64_t(ev.n)).add(ev.w,ev.n*sizeof(double));
+      hash(row.lo)(row.hi)
+          (fit_range)(npar)(cfg.fixed)(pars_init)(limits)(nbins)
+          (use_chi2_pars);
+      key = hash.hex();
     }
 
-    m.Migrad();
-    for (unsigned i=0; i<NPAR; ++i)
-      m.GetParameter(i,pars[i],errs[i]);
+    if (cache.get(key,chi2_pars,chi2_errs,chi2_logl,row)) {
+      info("From cache",key);
+      TF1 *f = static_cast<TF1*>(fit2->Clone());
+      f->SetParameters(chi2_pars.data());
+      f->SetParErrors(chi2_errs.data());
+      f->SetTitle(cat(
+          std::setprecision(15),std::scientific,
+          "#chi^{2} = ",row.chi2,","
+          "-2LogL = ",chi2_logl
+        ).c_str());
+      h->GetListOfFunctions()->Add(f);
+      std::copy(row.pars,row.pars+NPAR,pars);
+      std::copy(row.errs,row.errs+NPAR,errs);
+    } else {
+      info("χ² fit");
+      row.chi2 = hj::chi2_fit(h,fit2,opt,hj_mass_bin);
+      TF1 *f = static_cast<TF1*>(h->GetListOfFunctions()->At(0));
+      for (unsigned i=0; i<=NPAR; ++i) {
+        chi2_pars[i] = f->GetParameter(i);
+        chi2_errs[i] = f->GetParError(i);
+      }
+      chi2_logl = LogL(chi2_pars.data()+1);
+      f->SetTitle(cat(
+          std::setprecision(15),std::scientific,
+          "#chi^{2} = ",row.chi2,","
+          "-2LogL = ",chi2_logl
+        ).c_str());
+      // f->SetParameter(4, npar>3 ? mod_phi(f->GetParameter(4)) : 0.);
+
+      info("LogL fit");
+      auto define = [&](TMinuit& m) {
+        m.SetPrintLevel(print_level);
+
+        for (unsigned i=0; i<NPAR; ++i)
+          m.DefineParameter(
+            i,             // parameter number
+            pars_names[i], // parameter name
+            use_chi2_pars ? f->GetParameter(i+1) : pars_init[i], // start value
+            0.01,          // step size
+            limits[i][0],  // mininum
+            limits[i][1]   // maximum
+          );
+
+        for (unsigned i=0; i<NPAR; ++i)
+          if (cfg.is_fixed(i)) m.FixParameter(i);
+      };
+      minuit<decltype(LogL)> m(NPAR,LogL);
+      define(m);
+
+      row.status = prof::timed(prof::get("logl fit "+hj_mass_bin),
+        [&]{ return m.Migrad(); });
+      for (unsigned i=0; i<NPAR; ++i)
+        m.GetParameter(i,pars[i],errs[i]);
+
+      std::copy(pars,pars+NPAR,row.pars);
+      std::copy(errs,errs+NPAR,row.errs);
+      hj::get_covariance(m,NPAR,[&](unsigned i){ return !cfg.is_fixed(i); },row.cov);
+      row.nfcn = m.fNfcn;
+      row.logl = LogL(pars);
+
+      if (float_check()) {
+        minuit<decltype(LogL_double)> md(NPAR,LogL_double);
+        define(md);
+        prof::timed(prof::get("logl fit double "+hj_mass_bin),
+          [&]{ return md.Migrad(); });
+        double dpars = 0;
+        for (unsigned i=0; i<NPAR; ++i) {
+          if (cfg.is_fixed(i)) continue;
+          double p, e;
+          md.GetParameter(i,p,e);
+          if (e > 0) dpars = std::max(dpars,std::abs(p-pars[i])/e);
+        }
+        const double dlogl = std::abs(row.logl - LogL_double(pars));
+        info("Float error",cat("-2LogL ",dlogl,", parameters ",dpars," σ"));
+        if (float_check_logl > 0 && !(dlogl <= float_check_logl)) {
+          cerr << error("float events: -2LogL error above ",
+            float_check_logl," in hj_mass ",hj_mass_bin) << endl;
+          return false;
+        }
+        if (float_check_pars > 0 && !(dpars <= float_check_pars)) {
+          cerr << error("float events: parameters error above ",
+            float_check_pars," σ in hj_mass ",hj_mass_bin) << endl;
+          return false;
+        }
+      }
+
+      cache.put(key,chi2_pars,chi2_errs,chi2_logl,row);
+    }
 
     fit->SetParameters(pars);
     fit->SetParErrors(errs);
     fit->SetTitle(cat(
       std::setprecision(17),std::scientific,
-      "-2LogL = ",LogL(pars)).c_str());
-    bin.h->GetListOfFunctions()->Add(fit);
+      "-2LogL = ",row.logl).c_str());
+    results.fill(row);
+    h->GetListOfFunctions()->Add(fit);
 
-    bin.h->Write();
+    h->Write();
   }
 
   info("Saving",fout.GetName());
+  prof::scope t_(prof::get("write"));
   fout.Write(0,TObject::kOverwrite);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  const char* isa_name = nullptr;
+  const char *ifname, *ofname = nullptr, *cfname = nullptr;
+  const char *shared_dir = nullptr, *spill_dir = nullptr;
+  double mem_budget = 4096;
+  fit_config base;
+  std::vector<std::string> fix;
+  std::tuple<unsigned,double,double> hj_mass_binning;
+  int print_level = 0;
+  unsigned njobs = 1;
+  std::string cache_dir;
+  if (const char* env = std::getenv("FIT_CACHE")) cache_dir = env;
+
+  std::vector<fit_config> configs;
+  try {
+    using namespace ivanp::po;
+    if (program_options()
+        (ifname,'i',"input file",req(),pos())
+        (ofname,'o',"output file")
+        (cfname,"--configs","file with one fit configuration per line:\n"
+         "output file, then -n -r -p --fix --use-chi2-pars --nbins\n"
+         "overriding the command line values")
+        (hj_mass_binning,'M',"Higgs+jet mass binning",req())
+        (base.npar,'n',cat("number of fit parameters [",base.npar,']'))
+        (base.fit_range,'r',cat("max cosθ fit range [",base.fit_range,']'))
+        (base.pars_init,'p',"parameters' initial values")
+        (fix,"--fix","fixed parameters, e.g. --fix c6 phi2")
+        (base.use_chi2_pars,"--use-chi2-pars")
+        (base.nbins,"--nbins",cat('[',base.nbins,']'))
+        (njobs,{"-j","--jobs"},"configurations fitted in parallel [1]")
+        (spill_dir,"--spill","move events to files in this directory\n"
+         "above the memory budget")
+        (mem_budget,"--mem-budget",cat("events memory budget, MB [",
+         mem_budget,']'))
+        (float_events,"--float","LogL fit to single precision events")
+        (float_check_logl,"--float-check-logl",
+         "with --float, refit in double and fail if\n"
+         "-2LogL differs by more")
+        (float_check_pars,"--float-check-pars",
+         "with --float, refit in double and fail if\n"
+         "a parameter differs by more, in units of its error")
+        (shared_dir,"--shared","share the binned events between jobs\n"
+         "through a file in this directory, e.g. /dev/shm")
+        (cache_dir,"--cache","per-bin fit results cache directory\n"
+         "default: $FIT_CACHE, none if unset")
+        (print_level,"--print-level",
+         "-1 - quiet (also suppress all warnings)\n"
+         " 0 - normal (default)\n"
+         " 1 - verbose")
+        (isa_name,"--isa","kernels ISA: generic, sse4.2, avx2, avx512\n"
+         "default: $ANGLES_ISA, else the best supported")
+        .parse(argc,argv,true)) return 0;
+    for (const auto& name : fix) base.fixed |= 1u << par_index(name);
+
+    if (ofname) {
+      configs.push_back(base);
+      configs.back().ofname = ofname;
+    }
+    if (cfname) {
+      std::ifstream f(cfname);
+      if (!f) throw error("cannot read ",cfname);
+      for (std::string line; std::getline(f,line); ) {
+        if (line.find_first_not_of(" \t")==std::string::npos
+          || line[0]=='#') continue;
+        configs.push_back(base);
+        try {
+          configs.back().parse(line);
+        } catch (const std::exception& e) {
+          throw error("in ",cfname,": ",e.what());
+        }
+      }
+    }
+    if (configs.empty()) throw error("no output file or configurations");
+    for (const auto& cfg : configs) cfg.check();
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
+  cpu::init(isa_name); // logs the kernels ISA at startup
+  if (!njobs) njobs = 1;
+
+  // shared with the workers, which together keep to the budget
+  std::shared_ptr<spill_budget> budget;
+  if (spill_dir) {
+    try {
+      budget = make_shared_budget(spill_dir,size_t(mem_budget*(1<<20)));
+    } catch (const std::exception& e) {
+      cerr << e << endl;
+      return 1;
+    }
+    spill = budget.get();
+  }
+
+  const uniform_axis<double> axis(hj_mass_binning);
+  event_store::arena hj_mass_bins;
+  std::vector<bin_events> events;
+  event_store::store shared;
+
+  if (shared_dir) { // one copy of the events per node
+    try {
+      char* rp = realpath(ifname,nullptr);
+      if (!rp) throw error("cannot find ",ifname);
+      const std::string path = rp;
+      free(rp);
+      struct stat st;
+      if (stat(path.c_str(),&st)) throw error("cannot stat ",path);
+      // by content too: a file rewritten in place may keep size and mtime
+      const std::string name = cat(shared_dir,"/angles_hj-",
+        fit_cache::hasher()(event_store::version)(path)
+          (int64_t(st.st_size))(int64_t(st.st_mtime))
+          (prof::timed(prof::get("input hash"),
+            [&]{ return fit_cache::file_hash(path); }))
+          (std::get<0>(hj_mass_binning))(std::get<1>(hj_mass_binning))
+          (std::get<2>(hj_mass_binning)).hex());
+      shared = event_store::open(name,[&]{
+        if (!read_angles(ifname,axis,hj_mass_bins))
+          throw error("cannot read ",ifname);
+        info("Sharing events",name);
+        return hj_mass_bins.views();
+      });
+      hj_mass_bins = event_store::arena(); // free the private copy
+      info("Shared events",name);
+    } catch (const std::exception& e) {
+      cerr << e << endl;
+      return 1;
+    }
+    events = shared.bins();
+    if (events.size()!=axis.nbins()) {
+      cerr << error("shared events do not match the binning") << endl;
+      return 1;
+    }
+  } else {
+    if (!read_angles(ifname,axis,hj_mass_bins)) return 1;
+    events = hj_mass_bins.views();
+  }
+
+  TH1::AddDirectory(false);
+
+  const std::array<std::array<double,2>,NPAR> limits {{
+    {-1e-4,2.}, {0.,0.}, {0.,0.}, {-1e-4,M_PI}
+  }};
+
+  // The events are read and binned once for all the configurations.
+  // With several jobs, configurations are fitted by worker processes,
+  // as TMinuit is not thread safe.
+  const unsigned nconf = configs.size();
+  if (njobs > nconf) njobs = nconf;
+  if (njobs == 1) {
+    fit_cache::cache cache(cache_dir);
+    for (const auto& cfg : configs)
+      if (!fit_bins(cfg,axis,events,limits,cache,print_level)) return 1;
+    if (cache)
+      info("Fit cache",cat(cache.hits," hits, ",cache.misses," misses"));
+    return 0;
+  }
+
+  info("Workers",njobs);
+  cout.flush();
+  // cache counts of the workers, in memory shared with them
+  struct cache_stats { std::atomic<long unsigned> hits, misses; };
+  void* stats_mem = mmap(nullptr,sizeof(cache_stats),PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if (stats_mem==MAP_FAILED) {
+    cerr << error("mmap: ",strerror(errno)) << endl;
+    return 1;
+  }
+  cache_stats& stats = *new(stats_mem) cache_stats { {0}, {0} };
+  // each worker writes its profile to a file of its own, merged below
+  const char* prof_report = prof::enabled() ? std::getenv("PROF_REPORT")
+                                            : nullptr;
+  auto worker_report = [=](unsigned k){ return cat(prof_report,'.',k); };
+  std::vector<pid_t> workers;
+  for (unsigned k=0; k<njobs; ++k) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+      cerr << error("fork failed: ",strerror(errno)) << endl;
+      return 1;
+    }
+    if (pid == 0) {
+      prof::reset(); // counted by the parent
+      fit_cache::cache cache(cache_dir);
+      bool ok = true;
+      for (unsigned i=k; i<nconf; i+=njobs)
+        ok = fit_bins(configs[i],axis,events,limits,cache,print_level) && ok;
+      stats.hits += cache.hits;
+      stats.misses += cache.misses;
+      if (prof_report) prof::write(worker_report(k).c_str());
+      cout.flush();
+      _exit(ok ? 0 : 1); // no destructors: they are the parent's
+    }
+    workers.push_back(pid);
+  }
+  bool ok = true;
+  for (unsigned k=0; k<njobs; ++k) {
+    int status;
+    waitpid(workers[k],&status,0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status)==0;
+    if (prof_report) {
+      const std::string fname = worker_report(k);
+      prof::merge(fname.c_str());
+      std::remove(fname.c_str());
+    }
+  }
+  if (!cache_dir.empty())
+    info("Fit cache",cat(stats.hits," hits, ",stats.misses," misses"));
+  munmap(stats_mem,sizeof(cache_stats));
+  if (!ok) {
+    cerr << error("a worker failed") << endl;
+    return 1;
+  }
 }
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <array>
 #include <vector>
+#include <memory>
 
 #include <TFile.h>
 #include <TTree.h>
@@ -13,6 +14,7 @@
 #include "math.hh"
 #include "minuit.hh"
 #include "Legendre.hh"
+#include "column_store.hh"
 
 #define _STR(S) #S
 #define STR(S) _STR(S)
@@ -31,7 +33,8 @@ inline void write(const char* name, Args&&... args) {
 #define NPAR 4
 
 int main(int argc, char* argv[]) {
-  const char *ifname, *ofname;
+  const char *ifname, *ofname, *spill_dir = nullptr;
+  double mem_budget = 4096;
   // std::array<double,2> range {0,1};
   unsigned npar = NPAR, nbins = 100;
   std::array<double,NPAR> pars_init {0,0,0,0}, pars_lim {1,1,1,M_PI};
@@ -46,6 +49,10 @@ int main(int argc, char* argv[]) {
         (pars_init,'p',"parameters' initial values")
         (pars_lim,'l',"parameters' limits")
         (nbins,"--nbins",cat('[',nbins,']'))
+        (spill_dir,"--spill","move events to files in this directory\n"
+         "above the memory budget")
+        (mem_budget,"--mem-budget",cat("events memory budget, MB [",
+         mem_budget,']'))
         .parse(argc,argv,true)) return 0;
     if (npar>NPAR) throw std::runtime_error("npar > " STR(NPAR));
   } catch (const std::exception& e) {
@@ -71,22 +78,29 @@ int main(int argc, char* argv[]) {
 
   TH1D *h = new TH1D("abs_cos_theta","|cos_theta #theta|",nbins,0,1);
 
-  std::vector<double> vals;
+  std::unique_ptr<spill_budget> budget;
+  if (spill_dir)
+    budget.reset(new spill_budget(spill_dir,size_t(mem_budget*(1<<20))));
+
+  column_store vals(1,budget.get());
   const Long64_t nent = tin->GetEntries();
-  vals.reserve(nent);
+  if (!budget) vals.reserve(nent);
 
   for (timed_counter<Long64_t> ent(nent); !!ent; ++ent) {
     tin->GetEntry(ent);
     const double x = std::abs(cos_theta);
     // if (x>range[1]) continue;
-    vals.push_back(x);
+    vals.push(&x);
     h->Fill(x);
   }
+  vals.finish();
   info("Number of points",vals.size());
 
+  const double* xs = vals.col(0);
+  const size_t nvals = vals.size();
   auto LogL = [&](double* c){
     double logl = 0.;
-    for (double x : vals) logl += std::log(Legendre(&x,c));
+    for (size_t i=0; i<nvals; ++i) logl += std::log(Legendre(xs+i,c));
     return -2.*logl;
   };
 
@@ -4,9 +4,16 @@
 #include <vector>
 #include <tuple>
 #include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <boost/optional.hpp>
 
+#include <TROOT.h>
 #include <TFile.h>
 #include <TChain.h>
 #include <TTreeReader.h>
@@ -23,9 +30,19 @@
 #include "minuit.hh"
 #include "binner.hh"
 #include "category_bin.hh"
+#include "binner_io.hh"
+#include "binner_replicas.hh"
 #include "math.hh"
 #include "Legendre.hh"
 #include "float_or_double_reader.hh"
+#include "kernels.hh"
+#include "fit_cache.hh"
+#include "column_store.hh"
+#include "prof.hh"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define _STR(S) #S
 #define STR(S) _STR(S)
@@ -51,8 +68,6 @@ inline bool ends_with(const char* str, const char(&suffix)[N]) {
   return starts_with(str+(len-N+1),suffix);
 }
 
-double weight = 1., cos_theta;
-
 MAKE_ENUM(isp,(all)(gg)(gq)(qq))
 isp get_isp(Int_t id1, Int_t id2) noexcept {
   const bool g1 = (id1 == 21), g2 = (id2 == 21);
@@ -60,17 +75,68 @@ isp get_isp(Int_t id1, Int_t id2) noexcept {
   else return isp::gq;
 }
 
-struct xw { double x, w; };
+spill_budget* spill = nullptr; // events go to disk above it, if set
+
+// Events in structure of arrays layout:
+// cos θ, and one column per weight
 struct mass_bin {
-  std::vector<xw> v;
-  mass_bin(): v() { v.reserve(1<<10); }
-  inline void operator()() {
-    if (std::abs(cos_theta)>1.) return;
-    v.push_back({cos_theta,weight});
+  column_store events;
+  std::vector<double> row;
+  mass_bin(): events(0,spill) { }
+  inline void operator()(double _x, const std::vector<double>& _w) {
+    if (std::abs(_x)>1.) return;
+    if (!events.ncol()) {
+      events.columns(1+_w.size());
+      events.reserve(1<<10);
+      row.resize(1+_w.size());
+    }
+    row[0] = _x;
+    std::copy(_w.begin(),_w.end(),row.begin()+1);
+    events.push(row.data());
+  }
+  // room for n events in ncol columns
+  void reserve(size_t n, unsigned ncol) {
+    if (!events.ncol()) {
+      events.columns(ncol);
+      row.resize(ncol);
+    }
+    events.reserve(n);
+  }
+  inline mass_bin& operator+=(const mass_bin& b) {
+    events.append(b.events);
+    return *this;
+  }
+  inline size_t size() const noexcept {
+    return events.ncol() ? events.size() : xf.size();
+  }
+  // after the last event
+  inline void finish() { events.finish(); }
+  inline void prefetch() const noexcept { events.prefetch(); }
+
+  // single precision copy of the events, see --float
+  std::vector<float> xf;
+  std::vector<std::vector<float>> wf;
+  // after finish(), the doubles are freed unless keep
+  void to_float(bool keep) {
+    const unsigned nc = events.ncol();
+    if (!nc) return;
+    const size_t n = events.size();
+    xf.assign(x(),x()+n);
+    wf.resize(nc-1);
+    for (unsigned k=0; k<nc-1; ++k)
+      wf[k].assign(weights(k),weights(k)+n);
+    if (!keep) events = column_store();
+  }
+  inline const double* x() const noexcept {
+    return events.ncol() ? events.col(0) : nullptr;
+  }
+  // weights in column k, null if there are no events
+  inline const double* weights(unsigned k) const noexcept {
+    return events.ncol() ? events.col(1+k) : nullptr;
   }
-  inline auto begin() const noexcept { return v.begin(); }
-  inline auto   end() const noexcept { return v.  end(); }
 };
+void serialize(std::ostream& os, const mass_bin& b) { b.events.write(os); }
+void deserialize(std::istream& is, mass_bin& b) { b.events.read(is); }
 
 struct lo_bin {
   double w = 0, w2 = 0;
@@ -80,17 +146,283 @@ struct lo_bin {
     w2 += weight*weight;
     ++n;
   }
+  inline lo_bin& operator+=(const lo_bin& b) noexcept {
+    w  += b.w;
+    w2 += b.w2;
+    n  += b.n;
+    return *this;
+  }
 };
 
 template <typename T>
-struct total { T all=0, selected=0; };
+struct total {
+  T all=0, selected=0;
+  inline total& operator+=(const total& t) noexcept {
+    all += t.all;
+    selected += t.selected;
+    return *this;
+  }
+};
+struct totals {
+  std::vector<total<double>> weight; // per weight column
+  total<long unsigned> entries, ncount;
+  inline totals& operator+=(const totals& t) {
+    if (weight.empty()) weight.resize(t.weight.size());
+    else if (!t.weight.empty() && weight.size()!=t.weight.size())
+      throw error("merging totals with different numbers of weights");
+    for (size_t k=0, nw=t.weight.size(); k<nw; ++k) weight[k] += t.weight[k];
+    entries += t.entries;
+    ncount += t.ncount;
+    return *this;
+  }
+};
+void serialize(std::ostream& os, const totals& t) {
+  io::serialize(os,t.weight);
+  io::serialize(os,t.entries);
+  io::serialize(os,t.ncount);
+}
+void deserialize(std::istream& is, totals& t) {
+  io::deserialize(is,t.weight);
+  io::deserialize(is,t.entries);
+  io::deserialize(is,t.ncount);
+}
+
+// Weight columns, in the order of the branches given with -w
+// A branch named "name[]" is an array of weights, e.g. of PDF replicas,
+// and provides as many columns as it has elements.
+struct weight_branches {
+  std::vector<std::string> names;
+  std::vector<bool> is_array;
+
+  weight_branches(const std::vector<const char*>& spec) {
+    for (const char* name : spec) {
+      const bool a = ends_with(name,"[]");
+      names.emplace_back(name, strlen(name) - (a ? 2 : 0));
+      is_array.push_back(a);
+    }
+    if (std::count(is_array.begin(),is_array.end(),true) > 1)
+      throw error("at most one weight array branch is allowed");
+  }
+
+  // names of nw columns
+  std::vector<std::string> columns(unsigned nw) const {
+    const unsigned ns = std::count(is_array.begin(),is_array.end(),false);
+    if (nw < ns || (ns==names.size() && nw!=ns))
+      throw error(nw," weight columns do not match the weight branches");
+    const unsigned na = nw - ns;
+    std::vector<std::string> cols;
+    for (unsigned i=0; i<names.size(); ++i) {
+      if (is_array[i])
+        for (unsigned j=0; j<na; ++j) cols.push_back(cat(names[i],'[',j,']'));
+      else cols.push_back(names[i]);
+    }
+    return cols;
+  }
+};
+
+// Event loop over one chain; cnt is incremented for every entry
+template <typename Bins, typename Counter>
+void read_chain(
+  TChain& chain, const weight_branches& wb,
+  Bins& hj_mass_bins, totals& tot, Counter& cnt
+) {
+  // Set up branches for reading
+  TTreeReader reader(&chain);
+
+  TTreeReaderValue<Int_t> _nparticle(reader,"nparticle");
+  TTreeReaderArray<Int_t> _kf(reader,"kf");
+
+  float_or_double_array_reader _px(reader,"px");
+  float_or_double_array_reader _py(reader,"py");
+  float_or_double_array_reader _pz(reader,"pz");
+  float_or_double_array_reader _E (reader,"E" );
+
+  std::vector<std::unique_ptr<float_or_double_value_reader>> _w;
+  std::vector<std::unique_ptr<float_or_double_array_reader>> _wa;
+  for (unsigned i=0; i<wb.names.size(); ++i) {
+    const char* name = wb.names[i].c_str();
+    if (wb.is_array[i]) {
+      _wa.emplace_back(new float_or_double_array_reader(reader,name));
+      _w.emplace_back();
+    } else {
+      _w.emplace_back(new float_or_double_value_reader(reader,name));
+      _wa.emplace_back();
+    }
+  }
+  std::vector<double> weights;
+
+  optional<TTreeReaderValue<Int_t>> _ncount;
+
+  TTreeReaderValue<Int_t> _id1(reader,"id1"), _id2(reader,"id2");
+
+#define OPT_BRANCH(NAME) \
+  if (!strcmp(bo->GetName(),#NAME)) _##NAME.emplace(reader,#NAME);
+
+  for (auto bo : *reader.GetTree()->GetListOfBranches()) {
+    OPT_BRANCH(ncount)
+    if (_ncount) break;
+  }
+
+#undef OPT_BRANCH
+
+  std::vector<TLorentzVector> jets;
+  unsigned ncount;
+
+  // Events are processed in blocks, each stage timed once per block.
+  // TTreeReader reads branches on first access, so "read" includes
+  // loading the branches.
+  auto& t_read   = prof::get("read");
+  auto& t_angles = prof::get("angles");
+  auto& t_fill   = prof::get("fill");
+
+  constexpr unsigned block = 1<<10;
+  std::vector<TLorentzVector> higgs(block), jet1(block);
+  std::vector<isp> procs(block);
+  std::vector<double> hj_mass(block), cos_theta(block);
+  std::vector<double> block_weights; // one row of weights per event
+  unsigned nw = 0;
+
+  // LOOP ===========================================================
+  for (bool more = true; more; ) {
+    unsigned n = 0;
+    prof::timed(t_read,[&]{
+      for (; n<block && (more = reader.Next()); ++n, ++cnt) {
+        weights.clear();
+        for (unsigned i=0; i<_w.size(); ++i) {
+          if (_w[i]) weights.push_back(**_w[i]);
+          else for (size_t j=0, m=_wa[i]->size(); j<m; ++j)
+            weights.push_back((*_wa[i])[j]);
+        }
+        if (tot.weight.empty()) tot.weight.resize(weights.size());
+        else if (tot.weight.size()!=weights.size())
+          throw error("number of weights changed at entry ",tot.entries.all);
+        nw = weights.size();
+        block_weights.resize(block*nw);
+        for (size_t k=0; k<nw; ++k) {
+          tot.weight[k].all += weights[k];
+          block_weights[n*nw+k] = weights[k];
+        }
+        tot.ncount.all += _ncount ? (ncount = **_ncount) : 1;
+        ++tot.entries.all;
+
+        // Read particles -------------------------------------------
+        const unsigned np = *_nparticle;
+        jets.clear();
+        if (jets.capacity()==0) jets.reserve(np-1);
+        for (unsigned i=0; i<np; ++i) {
+          if (_kf[i]==25) {
+            higgs[n].SetPxPyPzE(_px[i],_py[i],_pz[i],_E[i]);
+          } else {
+            jets.emplace_back(_px[i],_py[i],_pz[i],_E[i]);
+          }
+        }
+        // leading jet
+        jet1[n] = *std::max_element( jets.begin(), jets.end(),
+          [](const auto& a, const auto& b){ return a.Pt() < b.Pt(); });
+        procs[n] = get_isp(*_id1,*_id2);
+      }
+    });
+
+    prof::timed(t_angles,[&]{
+      for (unsigned e=0; e<n; ++e) {
+        const auto& Higgs = higgs[e];
+        const auto& jet = jet1[e];
+        const auto Q = Higgs + jet;
+        const double Q2 = Q*Q;
+        hj_mass[e] = std::sqrt(Q2);
+
+        const TLorentzVector Z(0,0,Q.E(),Q.Pz());
+        const auto ell = ((Q*jet)/Q2)*Higgs - ((Q*Higgs)/Q2)*jet;
+
+        cos_theta[e] = (ell*Z) / std::sqrt(sq(ell)*sq(Z));
+      }
+    });
+
+    // Fill ---------------------------------------------------------
+    prof::scope f_(t_fill);
+    for (unsigned e=0; e<n; ++e) {
+      weights.assign(block_weights.begin()+e*nw,
+                     block_weights.begin()+(e+1)*nw);
+      hj_mass_bins(hj_mass[e], procs[e], cos_theta[e], weights);
+    }
+  } // end event loop
+}
+
+// Partial results per input file =================================
+// The binned events and totals of each input file are kept in
+// <dir>/<hash of path, tree and mass binning>, and reused while the
+// file has the same size and either the same mtime or the same content.
+constexpr const char* partial_version = "fit2-partial-3";
+
+struct file_id {
+  std::string path;
+  uint64_t size;
+  int64_t mtime;
+  file_id(const char* name) {
+    char* rp = realpath(name,nullptr);
+    if (!rp) throw error("cannot find ",name);
+    path = rp;
+    free(rp);
+    struct stat st;
+    if (stat(path.c_str(),&st)) throw error("cannot stat ",path);
+    size = st.st_size;
+    mtime = st.st_mtime;
+  }
+};
+
+template <typename Bins>
+void save_partial(const std::string& entry, const file_id& id,
+  const Bins& bins, const totals& tot
+) {
+  const std::string tmp = entry+".tmp"+std::to_string(getpid());
+  { std::ofstream f(tmp,std::ios::binary);
+    io::write_snapshot(f,std::string(partial_version),
+      id.size,id.mtime,fit_cache::file_hash(id.path),tot,bins);
+  }
+  if (std::rename(tmp.c_str(),entry.c_str()))
+    throw error("cannot write ",entry);
+}
+
+// false if there is no valid entry; touched if only the mtime changed
+template <typename Bins>
+bool load_partial(const std::string& entry, const file_id& id,
+  Bins& bins, totals& tot, bool& touched
+) {
+  std::ifstream f(entry,std::ios::binary);
+  if (!f) return false;
+  try {
+    std::string version, hash;
+    uint64_t size;
+    int64_t mtime;
+    io::read_snapshot_header(f);
+    io::deserialize(f,version);
+    io::deserialize(f,size);
+    io::deserialize(f,mtime);
+    io::deserialize(f,hash);
+    if (version!=partial_version || size!=id.size) return false;
+    touched = (mtime!=id.mtime);
+    if (touched && hash!=fit_cache::file_hash(id.path)) return false;
+    deserialize(f,tot);
+    io::deserialize(f,bins);
+  } catch (const std::exception&) { return false; }
+  return true;
+}
 
 #define NPAR 4
 
 int main(int argc, char* argv[]) {
+  const char* isa_name = nullptr;
   std::vector<const char*> ifnames;
-  const char *ofname, *cfname;
+  const char *ofname = nullptr, *cfname;
+  const char *snapshot_ofname = nullptr;
+  const char *partials_dir = nullptr, *spill_dir = nullptr;
+  double mem_budget = 4096;
+  bool float_events = false;
+  double float_check_logl = 0, float_check_pars = 0;
+  unsigned nthreads = 0;
+  bool from_snapshots = false;
   const char* tree_name = "t3";
+  std::vector<const char*> weight_spec;
   int print_level = 0;
   unsigned prec = 10;
 
@@ -105,15 +437,40 @@ int main(int argc, char* argv[]) {
     using namespace ivanp::po;
     if (program_options()
       (ifnames,'i',"input file",req(),pos())
-      (ofname,'o',"output file",req())
+      (ofname,'o',"output file")
       (cfname,'c',"config file",req())
+      (snapshot_ofname,{"-s","--save-snapshot"},
+       "write binned events to a snapshot file\n"
+       "fitting is skipped if no output file is given")
+      (from_snapshots,"--snapshots",
+       "input files are snapshots to be merged")
+      (partials_dir,"--partials",
+       "keep binned events per input file in this directory\n"
+       "and process only new or changed files")
+      (spill_dir,"--spill","move events to files in this directory\n"
+       "above the memory budget")
+      (mem_budget,"--mem-budget",cat("events memory budget, MB [",
+       mem_budget,']'))
+      (float_events,"--float","LogL fit to single precision events")
+      (float_check_logl,"--float-check-logl",
+       "with --float, refit in double and fail if\n"
+       "-2LogL differs by more")
+      (float_check_pars,"--float-check-pars",
+       "with --float, refit in double and fail if\n"
+       "a parameter differs by more, in units of its error")
       (tree_name,{"-t","--tree"},cat("input TTree name [",tree_name,']'))
+      (weight_spec,{"-w","--weights"},
+       "weight branches [weight2], the first is nominal\n"
+       "name[] reads all elements of an array branch")
+      (nthreads,{"-j","--threads"},"number of threads reading files [all]")
       (prec,"--prec",cat("float precision [",prec,']'))
       (print_level,{"-v","--print-level"},
        "-1 - quiet (also suppress all warnings)\n"
        " 0 - normal (default)\n"
        " 1 - verbose",
        switch_init(1))
+      (isa_name,"--isa","kernels ISA: generic, sse4.2, avx2, avx512\n"
+       "default: $ANGLES_ISA, else the best supported")
       .parse(argc,argv,true)) return 0;
 
     try {
@@ -143,100 +500,182 @@ int main(int argc, char* argv[]) {
     cerr << e << endl;
     return 1;
   }
-
-  const bool root_out = ends_with(ofname,".root");
-
-  // Open input ntuples root file ===================================
-  TChain chain(tree_name);
-  info("Input ntuples");
-  for (const char* name : ifnames) {
-    if (!chain.Add(name,0)) return 1;
-    cout << "  " << name << endl;
+  cpu::init(isa_name); // logs the kernels ISA at startup
+  if (!ofname && !snapshot_ofname) {
+    cerr << error("need an output file or a snapshot file") << endl;
+    return 1;
   }
-  cout << endl;
-
-  // Set up branches for reading
-  TTreeReader reader(&chain);
-
-  TTreeReaderValue<Int_t> _nparticle(reader,"nparticle");
-  TTreeReaderArray<Int_t> _kf(reader,"kf");
-
-  float_or_double_array_reader _px(reader,"px");
-  float_or_double_array_reader _py(reader,"py");
-  float_or_double_array_reader _pz(reader,"pz");
-  float_or_double_array_reader _E (reader,"E" );
-
-  float_or_double_value_reader _weight(reader,"weight2");
+  const bool root_out = ofname && ends_with(ofname,".root");
 
-  optional<TTreeReaderValue<Int_t>> _ncount;
-
-  TTreeReaderValue<Int_t> _id1(reader,"id1"), _id2(reader,"id2");
-
-#define OPT_BRANCH(NAME) \
-  if (!strcmp(bo->GetName(),#NAME)) _##NAME.emplace(reader,#NAME);
-
-  for (auto bo : *reader.GetTree()->GetListOfBranches()) {
-    OPT_BRANCH(ncount)
-    if (_ncount) break;
+  if (weight_spec.empty()) weight_spec.push_back("weight2");
+  optional<weight_branches> wb_;
+  try {
+    wb_.emplace(weight_spec);
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
   }
+  const weight_branches& wb = *wb_;
 
-#undef OPT_BRANCH
+  std::unique_ptr<spill_budget> budget;
+  if (spill_dir) {
+    budget.reset(new spill_budget(spill_dir,size_t(mem_budget*(1<<20))));
+    spill = budget.get();
+  }
 
-  binner<category_bin<mass_bin,isp>, std::tuple<
-    axis_spec<uniform_axis<double>, false, false> >
-  > hj_mass_bins(cfg.v.at("M"));
+  using bins_type = binner<category_bin<mass_bin,isp>, std::tuple<
+    axis_spec<uniform_axis<double>, false, false> > >;
+  bins_type hj_mass_bins(cfg.v.at("M"));
 
-  TLorentzVector Higgs;
-  std::vector<TLorentzVector> jets;
+  totals tot;
 
-  total<double> total_weight;
-  total<long unsigned> total_entries, total_ncount;
-  unsigned ncount;
-
-  // LOOP ===========================================================
-  using cnt = ivanp::timed_counter<Long64_t>;
-  for (cnt ent(reader.GetEntries(true)); reader.Next(); ++ent) {
-    total_weight.all += (weight = *_weight);
-    total_ncount.all += _ncount ? (ncount = **_ncount) : 1;
-    ++total_entries.all;
-
-    // Read particles -----------------------------------------------
-    const unsigned np = *_nparticle;
-    jets.clear();
-    if (jets.capacity()==0) jets.reserve(np-1);
-    for (unsigned i=0; i<np; ++i) {
-      if (_kf[i]==25) {
-        Higgs.SetPxPyPzE(_px[i],_py[i],_pz[i],_E[i]);
-      } else {
-        jets.emplace_back(_px[i],_py[i],_pz[i],_E[i]);
+  if (from_snapshots) { // merge binned shards ======================
+    info("Input snapshots");
+    try {
+      for (const char* name : ifnames) {
+        std::ifstream f(name,std::ios::binary);
+        if (!f) throw error("cannot open ",name);
+        prof::timed(prof::get("merge snapshots"),
+          [&]{ io::merge_snapshot(f,tot,hj_mass_bins); });
+        cout << "  " << name << endl;
       }
+    } catch (const std::exception& e) {
+      cerr << e << endl;
+      return 1;
     }
-
-    decltype(hj_mass_bins)::bin_type::id<isp>()
-      = (unsigned)get_isp(*_id1,*_id2);
-    // --------------------------------------------------------------
-
-    // Jets ---------------------------------------------------------
-    std::sort( jets.begin(), jets.end(), [](const auto& a, const auto& b){
-      return a.Pt() > b.Pt();
+    cout << endl;
+  } else { // input files in parallel ===============================
+    // Every file is read into its own bins and totals, which are then
+    // merged in input order, so the result does not depend on the
+    // number of threads.
+    info("Input ntuples");
+    Long64_t nent = 0;
+    for (const char* name : ifnames) {
+      TChain chain(tree_name);
+      if (!chain.Add(name,0)) return 1;
+      nent += chain.GetEntries();
+      cout << "  " << name << endl;
+    }
+    cout << endl;
+
+#ifdef _OPENMP
+    if (nthreads) omp_set_num_threads(nthreads);
+    else nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+    info("Threads",nthreads);
+    if (nthreads > 1) ROOT::EnableThreadSafety();
+
+    const auto& M = cfg.v.at("M");
+    if (partials_dir) mkdir(partials_dir,0755);
+
+    const unsigned nf = ifnames.size();
+    // one replica per file, merged in input order
+    auto file_bins = make_replicas(hj_mass_bins,nf);
+    std::vector<totals> file_tot(nf);
+    std::vector<std::string> errors(nf);
+    std::atomic<unsigned> ncached { 0 };
+
+    { parallel_timed_counter<Long64_t> cnt(nent);
+      #pragma omp parallel for schedule(dynamic,1)
+      for (unsigned f=0; f<nf; ++f) {
+        const char* name = ifnames[f];
+        auto& bins = file_bins[f];
+        auto& t = file_tot[f];
+        auto c = cnt.local();
+        try {
+          boost::optional<file_id> id;
+          std::string entry;
+          if (partials_dir) { // only new or changed files
+            id.emplace(name);
+            fit_cache::hasher h;
+            h(partial_version)(id->path)(tree_name)
+              (get<0>(M))(get<1>(M))(get<2>(M))(weight_spec.size());
+            for (const char* w : weight_spec) h(w);
+            entry = cat(partials_dir,'/',h.hex());
+            bool touched = false;
+            if (load_partial(entry,*id,bins,t,touched)) {
+              if (touched) save_partial(entry,*id,bins,t);
+              c += t.entries.all;
+              ++ncached;
+              continue;
+            }
+            bins = bins_type(M); // in case the entry was partly read
+            t = { };
+          }
+          TChain chain(tree_name);
+          if (!chain.Add(name,0)) throw error("cannot read ",name);
+          read_chain(chain,wb,bins,t,c);
+          if (partials_dir) save_partial(entry,*id,bins,t);
+        } catch (const std::exception& e) {
+          errors[f] = e.what();
+        }
+      }
+    }
+    for (const auto& e : errors)
+      if (!e.empty()) { cerr << error(e) << endl; return 1; }
+    if (partials_dir) info("Cached partials",ncached,"of",nf);
+
+    prof::timed(prof::get("merge files"),[&]{
+      // merged bins are sized exactly, rather than grown file by file
+      if (!spill) {
+        auto& bins = hj_mass_bins.bins();
+        for (size_t i=0; i<bins.size(); ++i)
+          for (unsigned c=0; c<bins[i].bins.size(); ++c) {
+            size_t n = bins[i].bins[c].size();
+            unsigned ncol = bins[i].bins[c].events.ncol();
+            for (unsigned f=0; f<nf; ++f) {
+              const auto& b = file_bins[f].bins()[i].bins[c];
+              n += b.size();
+              if (!ncol) ncol = b.events.ncol();
+            }
+            if (ncol) bins[i].bins[c].reserve(n,ncol);
+          }
+      }
+      file_bins.merge();
+      for (const auto& t : file_tot) tot += t;
     });
-    const auto& jet1 = jets.front();
-
-    // Angles -------------------------------------------------------
-    const auto Q = Higgs + jet1;
-    const double Q2 = Q*Q;
-    const double hj_mass = std::sqrt(Q2);
-
-    const TLorentzVector Z(0,0,Q.E(),Q.Pz());
-    const auto ell = ((Q*jet1)/Q2)*Higgs - ((Q*Higgs)/Q2)*jet1;
+  }
 
-    cos_theta = (ell*Z) / std::sqrt(sq(ell)*sq(Z));
+  if (snapshot_ofname) {
+    std::ofstream f(snapshot_ofname,std::ios::binary);
+    prof::timed(prof::get("write snapshot"),
+      [&]{ io::write_snapshot(f,tot,hj_mass_bins); });
+    info("Saved snapshot",snapshot_ofname);
+    if (!ofname) return 0;
+  }
 
-    // Fill ---------------------------------------------------------
-    hj_mass_bins(hj_mass);
-  } // end event loop
+  // refit in double with either tolerance
+  const bool float_check = float_events
+    && (float_check_logl > 0 || float_check_pars > 0);
+
+  try { // map the spilled events
+    for (auto& cb : hj_mass_bins)
+      for (auto& b : cb.bins) b.finish();
+    // cos θ and weights rounded to float halve the memory and the
+    // traffic of the LogL fits, the sums stay in double
+    if (float_events) prof::timed(prof::get("to float"),[&]{
+      for (auto& cb : hj_mass_bins)
+        for (auto& b : cb.bins) b.to_float(float_check);
+    });
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
 
-  decltype(hj_mass_bins)::bin_type::id<isp>() = 0;
+  // Weight columns are fitted one after the other. The first is the
+  // nominal: with several columns, the output for the others goes to
+  // directories (root) or extra bins arrays (json) named after them.
+  const unsigned nw = tot.weight.size();
+  std::vector<std::string> columns;
+  try {
+    columns = wb.columns(nw);
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
+  if (nw > 1) info("Weight columns",nw);
 
   // OUTPUT FILE ####################################################
   std::ofstream out;
@@ -271,11 +710,17 @@ int main(int argc, char* argv[]) {
   } else {
     out.open(ofname);
     out.precision(prec);
-    out << "[{"
-      "\"weight\":["<<total_weight.all<<"],"
-      "\"entries\":["<<total_entries.all<<"],"
-      "\"ncount\":["<<total_ncount.all<<"]"
-      "},{";
+    out << "[{\"weight\":[";
+    for (unsigned k=0; k<nw; ++k) out << (k ? "," : "") << tot.weight[k].all;
+    out << "],"
+      "\"entries\":["<<tot.entries.all<<"],"
+      "\"ncount\":["<<tot.ncount.all<<"]";
+    if (nw > 1) {
+      out << ",\"weights\":[";
+      for (unsigned k=0; k<nw; ++k) out << (k ? ",\"" : "\"") << columns[k] << '\"';
+      out << ']';
+    }
+    out << "},{";
 
     { bool first = true;
     for (const auto& var : cfg.v) {
@@ -287,18 +732,37 @@ int main(int argc, char* argv[]) {
           << get<2>(var.second) << ']';
     }}
 
-    out << "},[";
+    out << '}';
   }
 
   // FITTING ########################################################
   double pars[NPAR+1], errs[NPAR+1];
 
+  // -2LogL of every column at the nominal LogL fit parameters,
+  // evaluated for all columns in one pass over the events
+  std::vector<std::vector<double>> logl_nominal;
+
+  for (unsigned k=0; k<nw; ++k) { // loop over weight columns
+  if (nw > 1) info("Weights",columns[k]);
+  if (root_out) {
+    if (k==0) fout->cd();
+    else fout->mkdir(columns[k].c_str())->cd();
+  } else out << ",[";
+
+  unsigned bin_i = 0;
   for (const auto& bin : hj_mass_bins) { // loop over bins
-    static unsigned bin_i = 0;
     const std::string hj_mass_bin = hj_mass_bins.bin_str(++bin_i);
     info("Fitting hj_mass",hj_mass_bin);
-    const auto& v = bin->v;
-    info("Events",v.size());
+    if (bin_i < hj_mass_bins.bins().size())
+      hj_mass_bins.bins()[bin_i]->prefetch();
+    const size_t n = bin->size();
+    const double *x = bin->x(), *w = bin->weights(k);
+    const float *xf = nullptr, *wf = nullptr;
+    if (float_events && n) {
+      xf = bin->xf.data();
+      wf = bin->wf[k].data();
+    }
+    info("Events",n);
 
     binner<lo_bin, std::tuple<
       axis_spec<uniform_axis<double>, false, false> >
@@ -314,7 +778,10 @@ int main(int argc, char* argv[]) {
       mid[i] = (a+b)*0.5;
     }
 
-    for (const auto& e : v) h(e.x,e.w);
+    prof::timed(prof::get("histogram"),[&]{
+      if (float_events) h.fill_batch(n,xf,wf);
+      else h.fill_batch(n,x,w);
+    });
 
     double total_w = 0;
     for (const auto& b : h) total_w += b.w;
@@ -345,13 +812,12 @@ int main(int argc, char* argv[]) {
       return chi2;
     };
 
-    auto fLogL = [&v](const double* c) -> double {
-      long double logl = 0.;
-      const unsigned n = v.size();
-      #pragma omp parallel for reduction(+:logl)
-      for (unsigned i=0; i<n; ++i)
-        logl += v[i].w*log(Legendre(&v[i].x,c));
-      return -2.*logl;
+    auto& t_logl = prof::get("logl "+hj_mass_bin);
+    auto fLogL = [=,&t_logl](const double* c) -> double {
+      prof::scope t_(t_logl);
+      return float_events
+        ? kernels::logl(xf,wf,n,c)
+        : kernels::logl(x,w,n,c);
     };
 
     info("χ² fit"); // %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -365,7 +831,8 @@ int main(int argc, char* argv[]) {
     mChi2.DefineParameter(
       NPAR, "A", total_w, total_w*1e-2, total_w*0.1, total_w*10);
 
-    mChi2.Migrad();
+    prof::timed(prof::get("chi2 fit "+hj_mass_bin),
+      [&]{ return mChi2.Migrad(); });
     for (unsigned i=0; i<=NPAR; ++i)
       mChi2.GetParameter(i,pars[i],errs[i]);
 
@@ -391,26 +858,79 @@ int main(int argc, char* argv[]) {
     }
 
     info("LogL fit"); // %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+    double start[NPAR];
+    std::copy(pars,pars+NPAR,start);
+    auto define = [&](TMinuit& m) {
+      m.SetPrintLevel(print_level);
+      for (unsigned i=0; i<NPAR; ++i) {
+        const auto& p = cfg.p[i];
+        m.DefineParameter(i, p.name.c_str(), start[i], p.step, p.a, p.b);
+      }
+    };
     minuit<decltype(fLogL)> mLogL(NPAR,fLogL);
-    mLogL.SetPrintLevel(print_level);
+    define(mLogL);
 
-    for (unsigned i=0; i<NPAR; ++i) {
-      const auto& p = cfg.p[i];
-      mLogL.DefineParameter(i, p.name.c_str(), pars[i], p.step, p.a, p.b);
+    prof::timed(prof::get("logl fit "+hj_mass_bin),
+      [&]{ return mLogL.Migrad(); });
+    for (unsigned i=0; i<NPAR; ++i)
+      mLogL.GetParameter(i,pars[i],errs[i]);
+
+    if (float_check && n) {
+      auto fLogL_double = [=](const double* c) -> double {
+        return kernels::logl(x,w,n,c);
+      };
+      minuit<decltype(fLogL_double)> md(NPAR,fLogL_double);
+      define(md);
+      prof::timed(prof::get("logl fit double "+hj_mass_bin),
+        [&]{ return md.Migrad(); });
+      double dpars = 0;
+      for (unsigned i=0; i<NPAR; ++i) {
+        double p, e;
+        md.GetParameter(i,p,e);
+        if (e > 0) dpars = std::max(dpars,std::abs(p-pars[i])/e);
+      }
+      const double dlogl = std::abs(fLogL(pars) - fLogL_double(pars));
+      info("Float error",cat("-2LogL ",dlogl,", parameters ",dpars," σ"));
+      if (float_check_logl > 0 && !(dlogl <= float_check_logl)) {
+        cerr << error("float events: -2LogL error above ",
+          float_check_logl," in hj_mass ",hj_mass_bin) << endl;
+        return 1;
+      }
+      if (float_check_pars > 0 && !(dpars <= float_check_pars)) {
+        cerr << error("float events: parameters error above ",
+          float_check_pars," σ in hj_mass ",hj_mass_bin) << endl;
+        return 1;
+      }
     }
 
-    mLogL.Migrad();
-    for (unsigned i=0; i<NPAR; ++i)
-      mChi2.GetParameter(i,pars[i],errs[i]);
+    // the same in-order chunk sums for double and float events
+    if (k==0 && nw > 1) {
+      logl_nominal.emplace_back(nw);
+      prof::timed(prof::get("logl columns"),[&]{
+        if (float_events) {
+          std::vector<const float*> wcols(nw);
+          for (unsigned j=0; j<nw; ++j) wcols[j] = bin->wf[j].data();
+          kernels::logl_cols(xf,wcols.data(),nw,n,pars,
+            logl_nominal.back().data());
+        } else {
+          std::vector<const double*> wcols(nw);
+          for (unsigned j=0; j<nw; ++j) wcols[j] = bin->weights(j);
+          kernels::logl_cols(x,wcols.data(),nw,n,pars,
+            logl_nominal.back().data());
+        }
+      });
+    }
 
     if (!root_out) {
       out << "\"logl\":{";
       for (unsigned i=0; i<NPAR; ++i) {
-        out <<'\"'<< mChi2.fCpnam[i] << "\":["
+        out <<'\"'<< mLogL.fCpnam[i] << "\":["
             << pars[i] <<','<< errs[i] << "],";
       }
       out << "\"chi2\":" << fChi2(pars);
       out << ",\"logl\":" << fLogL(pars);
+      if (nw > 1)
+        out << ",\"logl_nominal\":" << logl_nominal[bin_i-1][k];
       out << "}},[";
 
       { bool first = true;
@@ -430,11 +950,26 @@ int main(int argc, char* argv[]) {
       hist->GetListOfFunctions()->Add(tfLogL->Clone());
       hist->Write();
     }
+  } // end bins loop
+
+  if (!root_out) out << ']';
+  else if (nw > 1) { // -2LogL at the nominal parameters, per mass bin
+    const auto& M = cfg.v.at("M");
+    TH1D h("logl_nominal",
+      cat("-2LogL of ",columns[k]," at the ",columns[0]," LogL fit").c_str(),
+      get<0>(M), get<1>(M), get<2>(M));
+    h.SetXTitle("m_{Hj}");
+    for (unsigned b=0; b<logl_nominal.size(); ++b)
+      h.SetBinContent(b+1,logl_nominal[b][k]);
+    h.Write();
   }
+  } // end weight columns loop
+
   if (root_out) {
     info("Saving",fout->GetName());
+    prof::scope t_(prof::get("write"));
     fout->Write(0,TObject::kOverwrite);
   } else {
-    out << "]]";
+    out << ']';
   }
 }
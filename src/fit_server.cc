@@ -0,0 +1,361 @@
+// Long running fit server: the angles sample is read once and kept in
+// memory, sorted by Higgs+jet mass, and fits are done on request.
+//
+// Requests are lines with the same options as fit:
+//   -M 12:250:550 -n3 -r0.8 -p0:0:0:1 --use-chi2-pars --nbins=50
+// plus --fix to fix parameters by name, e.g. --fix c6 phi2.
+// Each request is answered with one line of JSON:
+//   {"bins":[[[lo,hi],events,{"c2":[val,err],...,"chi2":..,"logl":..,
+//     "status":..}],...],"time":seconds}
+// or {"error":"message"}. "stats" reports the cache, "quit" stops.
+//
+// Requests are read from stdin, or from a UNIX socket with -s, one
+// client at a time. In stdin mode, logs go to stderr.
+
+#include <iostream>
+#include <sstream>
+#include <array>
+#include <vector>
+#include <tuple>
+#include <map>
+#include <list>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <TChain.h>
+
+#include "program_options.hh"
+#include "timed_counter.hh"
+#include "tc_msg.hh"
+#include "hj_fit.hh"
+#include "prof.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::get;
+using namespace ivanp;
+
+// Events sorted by mass, so that any mass bin is a contiguous range
+struct sample {
+  std::vector<double> m, x, w; // w is empty if unweighted
+
+  template <typename Chain>
+  void load(Chain& chain) {
+    double hj_mass, cos_theta, weight = 1.;
+    chain.SetBranchAddress("hj_mass",&hj_mass);
+    chain.SetBranchAddress("cos_theta",&cos_theta);
+    const bool weighted = chain.GetBranch("weight");
+    if (weighted) chain.SetBranchAddress("weight",&weight);
+
+    const Long64_t n = chain.GetEntries();
+    std::vector<double> m0, x0, w0;
+    m0.reserve(n); x0.reserve(n);
+    if (weighted) w0.reserve(n);
+    for (timed_counter<Long64_t> ent(n); !!ent; ++ent) {
+      chain.GetEntry(ent);
+      m0.push_back(hj_mass);
+      x0.push_back(cos_theta);
+      if (weighted) w0.push_back(weight);
+    }
+
+    std::vector<size_t> idx(n);
+    std::iota(idx.begin(),idx.end(),0);
+    std::sort(idx.begin(),idx.end(),
+      [&](size_t a, size_t b){ return m0[a] < m0[b]; });
+    m.resize(n); x.resize(n);
+    if (weighted) w.resize(n);
+    for (size_t i=0; i<size_t(n); ++i) {
+      m[i] = m0[idx[i]];
+      x[i] = x0[idx[i]];
+      if (weighted) w[i] = w0[idx[i]];
+    }
+  }
+
+  inline std::array<size_t,2> range(double lo, double hi) const {
+    return {{
+      size_t(std::lower_bound(m.begin(),m.end(),lo) - m.begin()),
+      size_t(std::lower_bound(m.begin(),m.end(),hi) - m.begin())
+    }};
+  }
+  inline size_t size() const noexcept { return m.size(); }
+};
+
+// cos θ scaled by 1/range and cut to [-1,1], per (lo,hi,range)
+// Least recently used arrays are dropped above the memory limit.
+class bin_cache {
+public:
+  struct entry { std::vector<double> x, w; };
+  using key_type = std::tuple<double,double,double>;
+
+private:
+  const sample& s;
+  const size_t limit; // bytes
+  size_t bytes = 0;
+  std::list<key_type> lru;
+  std::map<key_type,
+    std::pair<std::shared_ptr<const entry>,std::list<key_type>::iterator>
+  > map;
+
+public:
+  long unsigned hits = 0, misses = 0;
+
+  bin_cache(const sample& s, size_t limit): s(s), limit(limit) { }
+
+  std::shared_ptr<const entry> get(double lo, double hi, double r) {
+    const key_type key(lo,hi,r);
+    auto it = map.find(key);
+    if (it != map.end()) {
+      ++hits;
+      lru.splice(lru.begin(),lru,it->second.second);
+      return it->second.first;
+    }
+    ++misses;
+
+    auto e = std::make_shared<entry>();
+    const auto ab = s.range(lo,hi);
+    const double scale = 1./r;
+    const bool weighted = !s.w.empty();
+    for (size_t i=ab[0]; i<ab[1]; ++i) {
+      const double x = s.x[i]*scale;
+      if (std::abs(x)>1.) continue;
+      e->x.push_back(x);
+      if (weighted) e->w.push_back(s.w[i]);
+    }
+    e->x.shrink_to_fit();
+    e->w.shrink_to_fit();
+
+    bytes += (e->x.size() + e->w.size())*sizeof(double);
+    lru.push_front(key);
+    map.emplace(key,std::make_pair(e,lru.begin()));
+    while (bytes > limit && lru.size() > 1) {
+      auto last = map.find(lru.back());
+      bytes -= (last->second.first->x.size()
+              + last->second.first->w.size())*sizeof(double);
+      map.erase(last);
+      lru.pop_back();
+    }
+    return e;
+  }
+
+  inline size_t size() const noexcept { return map.size(); }
+  inline size_t size_bytes() const noexcept { return bytes; }
+};
+
+// parameter name without the TLatex '#'
+inline const char* par_name(unsigned i) noexcept {
+  const char* name = hj::par_names[i];
+  return name + (name[0]=='#');
+}
+
+unsigned par_index(const std::string& name) {
+  for (unsigned i=0; i<hj::npar_max; ++i)
+    if (name==par_name(i) || name==hj::par_names[i]) return i;
+  throw error("unknown parameter ",name);
+}
+
+// Respond to one request line
+std::string respond(const std::string& line, sample& s, bin_cache& cache,
+  int print_level
+) {
+  std::vector<std::string> args { "fit" };
+  { std::istringstream ss(line);
+    for (std::string arg; ss >> arg; ) args.push_back(arg);
+  }
+
+  std::ostringstream out;
+  out.precision(17);
+
+  if (args.size()==2 && args[1]=="stats") {
+    out << "{\"events\":" << s.size()
+        << ",\"weighted\":" << (s.w.empty() ? "false" : "true")
+        << ",\"cache\":{\"bins\":" << cache.size()
+        << ",\"bytes\":" << cache.size_bytes()
+        << ",\"hits\":" << cache.hits
+        << ",\"misses\":" << cache.misses << "}}";
+    return out.str();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  std::tuple<unsigned,double,double> hj_mass_binning;
+  std::vector<std::string> fix;
+  double fit_range = 1.;
+  hj::fit_options opt;
+  opt.print_level = print_level;
+
+  std::vector<const char*> argv;
+  for (const auto& a : args) argv.push_back(a.c_str());
+  {
+    using namespace ivanp::po;
+    program_options()
+      (hj_mass_binning,'M',"Higgs+jet mass binning",req())
+      (opt.npar,'n',"number of fit parameters")
+      (fit_range,'r',"max cosθ fit range")
+      (opt.init,'p',"parameters' initial values")
+      (fix,"--fix","fixed parameters")
+      (opt.use_chi2_pars,"--use-chi2-pars")
+      (opt.nbins,"--nbins")
+      .parse(argv.size(),argv.data());
+  }
+  if (opt.npar>hj::npar_max) throw error("npar > ",hj::npar_max);
+  if (!(0 < fit_range && fit_range <= 1.))
+    throw error("fit range not in (0,1]");
+  for (const auto& name : fix) opt.fixed |= 1u << par_index(name);
+
+  const uniform_axis<double> axis(hj_mass_binning);
+  out << "{\"bins\":[";
+  for (unsigned b=1, nb=axis.nbins(); b<=nb; ++b) {
+    const double lo = axis.lower(b).get(), hi = axis.upper(b).get();
+    const auto e = cache.get(lo,hi,fit_range);
+    const size_t n = e->x.size();
+    // unnamed fit timers: requests may ask for any binning
+    const auto r = hj::fit(e->x.data(), e->w.empty() ? nullptr : e->w.data(),
+      n, opt);
+
+    if (b>1) out << ',';
+    out << "[[" << lo << ',' << hi << "]," << n << ",{";
+    for (unsigned i=0; i<hj::npar_max; ++i)
+      out << '\"' << par_name(i) << "\":["
+          << r.pars[i] << ',' << r.errs[i] << "],";
+    out << "\"chi2\":" << r.chi2
+        << ",\"logl\":" << r.logl
+        << ",\"status\":" << r.status << "}]";
+  }
+  out << "],\"time\":" << std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count() << '}';
+  return out.str();
+}
+
+// Serve requests from in until EOF or "quit"; returns false on "quit"
+bool serve(FILE* in, FILE* out, sample& s, bin_cache& cache,
+  int print_level
+) {
+  char* buf = nullptr;
+  size_t cap = 0;
+  bool more = true;
+  for (ssize_t len; (len = getline(&buf,&cap,in)) != -1; ) {
+    std::string line(buf,len);
+    while (!line.empty() && isspace(line.back())) line.pop_back();
+    if (line.empty() || line[0]=='#') continue;
+    if (line=="quit") { more = false; break; }
+    info("Request",line);
+    std::string resp;
+    try {
+      resp = respond(line,s,cache,print_level);
+    } catch (const std::exception& e) {
+      cerr << e << endl;
+      std::ostringstream ss;
+      ss << "{\"error\":\"";
+      for (const char* c = e.what(); *c; ++c) {
+        if (*c=='\"' || *c=='\\') ss << '\\';
+        if (*c=='\n') ss << ' ';
+        else ss << *c;
+      }
+      ss << "\"}";
+      resp = ss.str();
+    }
+    fputs(resp.c_str(),out);
+    fputc('\n',out);
+    fflush(out);
+  }
+  free(buf);
+  return more;
+}
+
+int main(int argc, char* argv[]) {
+  const char* isa_name = nullptr;
+  std::vector<const char*> ifnames;
+  const char *socket_name = nullptr;
+  const char *tree_name = "angles";
+  double cache_mb = 1024;
+  int print_level = -1;
+
+  try {
+    using namespace ivanp::po;
+    if (program_options()
+      (ifnames,'i',"input angles files",req(),pos())
+      (socket_name,{"-s","--socket"},"UNIX socket path\n"
+       "requests are read from stdin if not given")
+      (tree_name,{"-t","--tree"},cat("input TTree name [",tree_name,']'))
+      (cache_mb,"--cache",cat("prepared bins cache limit, MB [",cache_mb,']'))
+      (print_level,{"-v","--print-level"},
+       "-1 - quiet (default)\n"
+       " 0 - normal\n"
+       " 1 - verbose",
+       switch_init(0))
+      (isa_name,"--isa","kernels ISA: generic, sse4.2, avx2, avx512\n"
+       "default: $ANGLES_ISA, else the best supported")
+      .parse(argc,argv,true)) return 0;
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
+
+  // in stdin mode stdout carries only responses
+  FILE* out = stdout;
+  if (!socket_name) {
+    out = fdopen(dup(STDOUT_FILENO),"w");
+    dup2(STDERR_FILENO,STDOUT_FILENO);
+  }
+  cpu::init(isa_name); // logs the kernels ISA at startup
+
+  sample s;
+  { TChain chain(tree_name);
+    info("Input files");
+    for (const char* name : ifnames) {
+      if (!chain.Add(name,0)) return 1;
+      cout << "  " << name << endl;
+    }
+    prof::scope t_(prof::get("load"));
+    s.load(chain);
+  }
+  info("Events",s.size());
+
+  bin_cache cache(s, size_t(cache_mb*(1<<20)));
+
+  if (!socket_name) {
+    info("Ready","reading requests from stdin");
+    serve(stdin,out,s,cache,print_level);
+    return 0;
+  }
+
+  std::signal(SIGPIPE,SIG_IGN);
+  const int sock = socket(AF_UNIX,SOCK_STREAM,0);
+  sockaddr_un addr { };
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+    cerr << error("socket path too long") << endl;
+    return 1;
+  }
+  strcpy(addr.sun_path,socket_name);
+  unlink(socket_name);
+  if (sock < 0 || bind(sock,(sockaddr*)&addr,sizeof(addr)) < 0
+      || listen(sock,8) < 0) {
+    cerr << error("cannot listen on ",socket_name,": ",strerror(errno))
+         << endl;
+    return 1;
+  }
+  info("Ready","listening on",socket_name);
+
+  for (bool more = true; more; ) {
+    const int fd = accept(sock,nullptr,nullptr);
+    if (fd < 0) continue;
+    FILE *in = fdopen(fd,"r"), *fout = fdopen(dup(fd),"w");
+    more = serve(in,fout,s,cache,print_level);
+    fclose(fout);
+    fclose(in);
+  }
+  close(sock);
+  unlink(socket_name);
+}
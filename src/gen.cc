@@ -0,0 +1,351 @@
+// Synthetic H+jet event generator
+//
+// Writes samples in the formats read by the other programs:
+//   events : "events" tree with px[2],py[2],pz[2],E[2] for angles
+//   angles : "angles" tree with hj_mass, cos_theta, weight for fit
+//   t3     : BlackHat style "t3" ntuple for fit2
+//   text   : "pid px py pz E" for Higgs and jet per line for angles1
+//
+// cos θ is sampled from the Legendre() model used in the fits.
+// Events are generated in blocks, each seeded from the block number,
+// so the output does not depend on the number of threads.
+
+#include <iostream>
+#include <fstream>
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+#include <memory>
+#include <future>
+#include <cstdio>
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include "program_options.hh"
+#include "timed_counter.hh"
+#include "tc_msg.hh"
+#include "math.hh"
+#include "random.hh"
+#include "lorentz_vector.hh"
+#include "Legendre.hh"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using namespace ivanp;
+using namespace ivanp::math;
+
+constexpr double mH = 125.;
+constexpr unsigned max_jets = 4;
+constexpr unsigned block_size = 1<<16;
+
+struct event {
+  lorentz_vector H;
+  std::array<lorentz_vector,max_jets> jets; // leading jet first
+  unsigned njets;
+  int id1, id2;
+  double weight, hj_mass, cos_theta;
+};
+
+struct config {
+  std::array<double,4> coeffs {{0,0,0,0}};
+  std::array<double,2> mass {{200,1000}};
+  double slope = 4., ymax = 2.5;
+  double wspread = 0.5, wneg = 0.;
+  double p_extra = 0.3;
+  unsigned njets_max = 3;
+  long unsigned seed = 0;
+};
+
+int quark(std::mt19937_64& gen) {
+  const int q = std::uniform_int_distribution<int>(1,5)(gen);
+  return std::bernoulli_distribution(0.5)(gen) ? q : -q;
+}
+
+lorentz_vector boost_z(const lorentz_vector& p, double ch, double sh) {
+  return { p.t*ch + p.z*sh, p.x, p.y, p.z*ch + p.t*sh };
+}
+
+// generate one block of events
+template <typename CosDist>
+void generate(
+  std::vector<event>& evs, unsigned n, long unsigned iblock,
+  CosDist cos_dist, const config& cfg
+) {
+  std::seed_seq seq {
+    unsigned(cfg.seed), unsigned(cfg.seed>>32),
+    unsigned(iblock), unsigned(iblock>>32) };
+  std::mt19937_64 gen(seq);
+  std::uniform_real_distribution<double> unit(0.,1.);
+  std::normal_distribution<double> normal;
+
+  // power law mass spectrum, sampled by inverting the CDF
+  const double k = 1.-cfg.slope;
+  const double a = std::pow(cfg.mass[0],k), b = std::pow(cfg.mass[1],k);
+
+  evs.resize(n);
+  for (auto& ev : evs) {
+    const double M = std::pow(a + unit(gen)*(b-a),1./k);
+    const double c = cos_dist(gen);
+
+    // Higgs and jet in the H+j rest frame
+    // cos θ in angles is minus the Higgs polar angle cosine
+    const double p = (M*M - mH*mH)/(2.*M);
+    const double s = std::sqrt(1.-c*c), phi = 2.*M_PI*unit(gen);
+    const double px = p*s*std::cos(phi), py = p*s*std::sin(phi), pz = -p*c;
+
+    const double y = cfg.ymax*(2.*unit(gen)-1.);
+    const double ch = std::cosh(y), sh = std::sinh(y);
+    ev.H       = boost_z({std::sqrt(p*p+mH*mH), px, py, pz},ch,sh);
+    ev.jets[0] = boost_z({p,-px,-py,-pz},ch,sh);
+    ev.hj_mass = M;
+    ev.cos_theta = c;
+
+    // softer extra jets
+    const double pt1 = p*s;
+    ev.njets = 1;
+    while (ev.njets < cfg.njets_max && unit(gen) < cfg.p_extra) {
+      const double pt = 0.5*pt1*unit(gen), phi = 2.*M_PI*unit(gen),
+                   eta = 4.4*(2.*unit(gen)-1.);
+      ev.jets[ev.njets++] = {
+        pt*std::cosh(eta), pt*std::cos(phi), pt*std::sin(phi),
+        pt*std::sinh(eta) };
+    }
+
+    // initial state: 60% gg, 35% gq, 5% qq
+    const double r = unit(gen);
+    if (r < 0.6) { ev.id1 = ev.id2 = 21; }
+    else if (r < 0.95) {
+      ev.id1 = 21; ev.id2 = quark(gen);
+      if (unit(gen) < 0.5) std::swap(ev.id1,ev.id2);
+    } else { ev.id1 = quark(gen); ev.id2 = -ev.id1; }
+
+    ev.weight = std::exp(cfg.wspread*normal(gen));
+    if (unit(gen) < cfg.wneg) ev.weight = -ev.weight;
+  }
+}
+
+// Writers ==========================================================
+struct writer {
+  TTree *tree = nullptr;
+  virtual ~writer() { }
+  virtual void operator()(const event& ev) = 0;
+};
+
+struct events_writer final: writer {
+  double px[2], py[2], pz[2], E[2];
+  events_writer() {
+    tree = new TTree("events","");
+    tree->Branch("px",px,"px[2]/D");
+    tree->Branch("py",py,"py[2]/D");
+    tree->Branch("pz",pz,"pz[2]/D");
+    tree->Branch("E" ,E ,"E[2]/D" );
+  }
+  void operator()(const event& ev) {
+    for (unsigned i=0; i<2; ++i) {
+      const auto& p = i ? ev.jets[0] : ev.H;
+      px[i] = p.x; py[i] = p.y; pz[i] = p.z; E[i] = p.t;
+    }
+    tree->Fill();
+  }
+};
+
+struct angles_writer final: writer {
+  double hj_mass, cos_theta, weight;
+  angles_writer() {
+    tree = new TTree("angles","");
+    tree->Branch("hj_mass",&hj_mass);
+    tree->Branch("cos_theta",&cos_theta);
+    tree->Branch("weight",&weight);
+  }
+  void operator()(const event& ev) {
+    hj_mass = ev.hj_mass;
+    cos_theta = ev.cos_theta;
+    weight = ev.weight;
+    tree->Fill();
+  }
+};
+
+template <typename T>
+struct t3_writer final: writer {
+  Int_t nparticle, kf[max_jets+1], id1, id2;
+  T px[max_jets+1], py[max_jets+1], pz[max_jets+1], E[max_jets+1], weight2;
+  t3_writer() {
+    const std::string t = (sizeof(T)==8 ? "/D" : "/F");
+    tree = new TTree("t3","");
+    tree->Branch("nparticle",&nparticle);
+    tree->Branch("kf",kf,"kf[nparticle]/I");
+    tree->Branch("px",px,("px[nparticle]"+t).c_str());
+    tree->Branch("py",py,("py[nparticle]"+t).c_str());
+    tree->Branch("pz",pz,("pz[nparticle]"+t).c_str());
+    tree->Branch("E" ,E ,("E[nparticle]" +t).c_str());
+    tree->Branch("weight2",&weight2,("weight2"+t).c_str());
+    tree->Branch("id1",&id1);
+    tree->Branch("id2",&id2);
+  }
+  void operator()(const event& ev) {
+    nparticle = ev.njets + 1;
+    // the jet flavor follows the initial state, gq -> q
+    const int jet_kf = ev.id1!=21 && ev.id2==21 ? ev.id1
+                     : ev.id2!=21 && ev.id1==21 ? ev.id2 : 21;
+    for (int i=0; i<nparticle; ++i) {
+      const auto& p = i ? ev.jets[i-1] : ev.H;
+      kf[i] = i ? (i==1 ? jet_kf : 21) : 25;
+      px[i] = p.x; py[i] = p.y; pz[i] = p.z; E[i] = p.t;
+    }
+    weight2 = ev.weight;
+    id1 = ev.id1;
+    id2 = ev.id2;
+    tree->Fill();
+  }
+};
+
+// text lines are formatted by the generating threads
+void format_text(const std::vector<event>& evs, std::string& str) {
+  str.clear();
+  char line[256];
+  for (const auto& ev : evs) {
+    const auto &H = ev.H, &j = ev.jets[0];
+    const int len = snprintf(line,sizeof(line),
+      "25 %.9g %.9g %.9g %.9g 21 %.9g %.9g %.9g %.9g\n",
+      H.x, H.y, H.z, H.t, j.x, j.y, j.z, j.t);
+    str.append(line,len);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* ofname;
+  std::string format = "t3";
+  long unsigned nevents = 1000000;
+  unsigned nthreads = 0;
+  int compress = 101;
+  bool use_float = false;
+  config cfg;
+
+  try {
+    using namespace ivanp::po;
+    if (program_options()
+      (ofname,'o',"output file",req())
+      (format,'f',cat("output format: events, angles, t3, text [",format,']'))
+      (nevents,'N',cat("number of events [",nevents,']'),pos(1))
+      (cfg.coeffs,'c',"Legendre coefficients c2:c4:c6:phi2 [0:0:0:0]")
+      (cfg.mass,{"-m","--mass"},
+       cat("H+j mass range [",cfg.mass[0],':',cfg.mass[1],']'))
+      (cfg.slope,"--slope",cat("mass spectrum power law [",cfg.slope,']'))
+      (cfg.ymax,"--ymax",cat("max |y| of the H+j system [",cfg.ymax,']'))
+      (cfg.njets_max,"--njets",
+       cat("max number of jets, up to ",max_jets," [",cfg.njets_max,']'))
+      (cfg.wspread,"--wspread",
+       cat("log-normal weight spread, 0 for unweighted [",cfg.wspread,']'))
+      (cfg.wneg,"--wneg",
+       cat("fraction of negative weights [",cfg.wneg,']'))
+      (use_float,"--float","float t3 branches")
+      (compress,"--compress",cat("ROOT compression setting [",compress,']'))
+      (cfg.seed,"--seed",cat('[',cfg.seed,']'))
+      (nthreads,{"-j","--threads"},"number of threads [all]")
+      .parse(argc,argv,true)) return 0;
+    if (format!="events" && format!="angles" &&
+        format!="t3" && format!="text")
+      throw error("unknown output format ",format);
+    if (cfg.mass[0] <= mH || cfg.mass[1] <= cfg.mass[0])
+      throw error("mass range must be above ",mH);
+    if (cfg.njets_max < 1 || cfg.njets_max > max_jets)
+      throw error("number of jets must be between 1 and ",max_jets);
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
+
+#ifdef _OPENMP
+  if (nthreads) omp_set_num_threads(nthreads);
+  else nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  info("Threads",nthreads);
+  info("SEED",cfg.seed);
+
+  // Legendre envelope for accept-reject sampling
+  double fmax = 0;
+  for (int i=0; i<=1000; ++i) {
+    const double x = -1. + i*2e-3;
+    fmax = std::max(fmax,Legendre(&x,cfg.coeffs.data()));
+  }
+  const auto cos_dist = sample(-1.,1.,1.1*fmax,
+    [c=cfg.coeffs](double x){ return Legendre(&x,c.data()); });
+
+  // Output =========================================================
+  std::unique_ptr<TFile> fout;
+  std::ofstream tout;
+  std::unique_ptr<writer> write;
+  const bool is_text = (format=="text");
+  if (is_text) {
+    tout.open(ofname);
+    if (!tout) {
+      cerr << error("cannot open ",ofname) << endl;
+      return 1;
+    }
+  } else {
+    fout.reset(new TFile(ofname,"recreate","",compress));
+    if (fout->IsZombie()) return 1;
+    fout->cd();
+    if (format=="events") write.reset(new events_writer);
+    else if (format=="angles") write.reset(new angles_writer);
+    else if (use_float) write.reset(new t3_writer<Float_t>);
+    else write.reset(new t3_writer<Double_t>);
+  }
+  info("Output file",ofname);
+
+  // Generate =======================================================
+  // One batch of nthreads blocks is written while the next is generated
+  const long unsigned nblocks = (nevents + block_size - 1)/block_size;
+  struct batch {
+    std::vector<std::vector<event>> evs;
+    std::vector<std::string> text;
+    long unsigned first, n = 0;
+  };
+  auto produce = [&](batch& b, long unsigned first) {
+    b.first = first;
+    b.n = std::min<long unsigned>(nthreads,nblocks-first);
+    b.evs.resize(b.n);
+    if (is_text) b.text.resize(b.n);
+    #pragma omp parallel for schedule(static,1)
+    for (long unsigned i=0; i<b.n; ++i) {
+      const long unsigned iblock = first + i;
+      generate(b.evs[i],
+        std::min<long unsigned>(block_size,nevents-iblock*block_size),
+        iblock, cos_dist, cfg);
+      if (is_text) format_text(b.evs[i],b.text[i]);
+    }
+  };
+
+  batch cur, next;
+  produce(cur,0);
+  for (timed_counter<long unsigned> cnt(nevents); cur.n; ) {
+    const long unsigned first = cur.first + cur.n;
+    auto fut = std::async(std::launch::async, [&]{
+      if (first < nblocks) produce(next,first);
+      else next.n = 0;
+    });
+
+    for (long unsigned i=0; i<cur.n; ++i) {
+      if (is_text) tout << cur.text[i];
+      else for (const auto& ev : cur.evs[i]) (*write)(ev);
+      cnt += cur.evs[i].size();
+    }
+
+    fut.get();
+    std::swap(cur,next);
+  }
+
+  if (fout) {
+    info("Saving",fout->GetName());
+    fout->Write(0,TObject::kOverwrite);
+  }
+}
@@ -1,17 +1,22 @@
 #include <iostream>
 #include <vector>
-#include <unordered_map>
-#include <set>
+#include <map>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
 
 #include <TFile.h>
 #include <TH1.h>
 #include <TF1.h>
 #include <TMath.h>
+#include <TROOT.h>
 
 #include "program_options.hh"
 #include "tc_msg.hh"
 #include "tkey.hh"
-#include "ordered_map.hh"
+#include "fit_results.hh"
 
 #define TEST(var) \
   std::cout << "\033[36m" #var "\033[0m = " << var << std::endl;
@@ -21,27 +26,38 @@ using std::cerr;
 using std::endl;
 using namespace ivanp;
 
-ordered_map<std::vector<double>> hj_mass_bins;
-
-void loop(TDirectory* dir) { // LOOP
-  for (TKey& key : get_keys(dir)) {
-    const TClass* key_class = get_class(key);
-    const char* key_name = key.GetName();
-    if (inherits_from<TH1>(key_class)) { // TH1
-      const char* bin1 = strchr(key_name,'[');
-      const char* bin2 = strchr(bin1+1,')');
-      for (TObject* obj : *key_cast<TH1>(key)->GetListOfFunctions()) {
-        if (!obj->InheritsFrom(TF1::Class())) continue;
-        if (!strstr(obj->GetName(),"-logl")) continue;
-        // TF1 *f = static_cast<TF1*>(obj);
-
-        hj_mass_bins[std::string(bin1,bin2-bin1+1)].push_back(
-          atof(strchr(obj->GetTitle(),'=')+1));
-      }
-    } else if (inherits_from<TDirectory>(key_class)) { // DIR
-      loop(key_cast<TDirectory>(key));
+// -2LogL from each file, by bin edges
+std::map<std::array<double,2>,std::vector<double>> hj_mass_bins;
+
+// per bin histograms have the bin in the name, e.g. "...[250,275)"
+inline bool is_bin(const char* name) { return strchr(name,'['); }
+
+using bin_logl = std::vector<std::pair<std::array<double,2>,double>>;
+
+// -2LogL of the fits in one file,
+// from the results table if present, else from the "-logl" TF1s
+bin_logl read_logl(const char* ifname) {
+  TFile f(ifname);
+  if (f.IsZombie()) throw error("cannot read ",ifname);
+  bin_logl out;
+  const auto rows = hj::read_fit_results(&f);
+  for (const auto& row : rows)
+    out.push_back({{{row.lo,row.hi}},row.logl});
+  if (!rows.empty()) return out;
+
+  read_keys<TH1>(&f,is_bin,[&](TH1* h, TKey& key){
+    const char* bin = strchr(key.GetName(),'[');
+    for (TObject* obj : *h->GetListOfFunctions()) {
+      if (!obj->InheritsFrom(TF1::Class())) continue;
+      if (!strstr(obj->GetName(),"-logl")) continue;
+
+      char* end;
+      const double a = strtod(bin+1,&end), b = strtod(end+1,nullptr);
+      out.push_back({{{a,b}},atof(strchr(obj->GetTitle(),'=')+1)});
     }
-  }
+    delete h;
+  });
+  return out;
 }
 
 int main(int argc, char* argv[]) {
@@ -61,51 +77,68 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  for (const char* ifname : ifnames) {
-    TFile f(ifname);
-    info("Input file",f.GetName());
-    if (f.IsZombie()) return 1;
-    loop(&f);
+  // files are read in parallel by a pool of threads, and merged in order
+  ROOT::EnableThreadSafety();
+  const unsigned nfiles = ifnames.size();
+  std::vector<bin_logl> files(nfiles);
+  std::vector<std::exception_ptr> errors(nfiles);
+  std::atomic<unsigned> next(0);
+  std::vector<std::thread> pool(std::min(nfiles,
+    std::max(std::thread::hardware_concurrency(),1u)));
+  for (auto& t : pool) t = std::thread([&]{
+    for (unsigned i; (i = next++) < nfiles; ) {
+      try {
+        files[i] = read_logl(ifnames[i]);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  });
+  for (auto& t : pool) t.join();
+  for (unsigned i=0; i<nfiles; ++i) {
+    try {
+      if (errors[i]) std::rethrow_exception(errors[i]);
+    } catch (const std::exception& e) {
+      cerr << e << endl;
+      return 1;
+    }
+    for (auto& b : files[i])
+      hj_mass_bins[b.first].push_back(b.second);
+    info("Input file",ifnames[i]);
   }
   if (hj_mass_bins.size()==0) {
     error("no function found");
     return 1;
   } else info("hj_mass bins",hj_mass_bins.size());
-  hj_mass_bins.sort();
 
   TFile fout(ofname,"recreate");
   info("Output file",fout.GetName());
   if (fout.IsZombie()) return 1;
   fout.cd();
 
+  // gaps between bins get empty histogram bins
   std::vector<double> bins;
-  std::set<unsigned> skip;
-  unsigned i = 1;
+  std::vector<unsigned> hbin; // histogram bin of each mass bin
   for (const auto& b : hj_mass_bins) {
-    const auto& str = b.first;
-    const auto d = str.find(',');
-    std::array<double,2> bin {
-      stod(str.substr(1,d-1)),
-      stod(str.substr(d+1,str.size()-d-2))
-    };
-
-    if (bins.empty() || bins.back()!=bin[0]) {
-      if (!bins.empty()) skip.insert(i);
-      bins.push_back(bin[0]);
-    }
-    bins.push_back(bin[1]);
-    ++i;
+    if (bins.empty() || bins.back()!=b.first[0]) bins.push_back(b.first[0]);
+    bins.push_back(b.first[1]);
+    hbin.push_back(bins.size()-1);
   }
 
   for (unsigned f=1, nf=ifnames.size(); f<nf; ++f) {
     TH1D* h_llr = new TH1D(cat("LLR",f).c_str(),"#Delta(-2LogL)",bins.size()-1,bins.data());
     TH1D* h_p = new TH1D(cat("P",f).c_str(),"P-value",bins.size()-1,bins.data());
-    i = 1;
+    unsigned i = 0;
     for (const auto& b : hj_mass_bins) {
-      if (skip.count(i)) ++i;
+      if (b.second.size()!=nf) {
+        if (f==1) warning("missing fits for hj_mass",
+          '[',b.first[0],',',b.first[1],')');
+        ++i;
+        continue;
+      }
       const double llr = b.second.front()-b.second[f];
-      h_llr->SetBinContent(i,llr);
-      h_p->SetBinContent(i,TMath::Prob(llr,1));
+      h_llr->SetBinContent(hbin[i],llr);
+      h_p->SetBinContent(hbin[i],TMath::Prob(llr,1));
       ++i;
     }
   }
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <iomanip>
 #include <array>
 #include <vector>
 #include <tuple>
@@ -16,6 +17,8 @@
 #include "math.hh"
 #include "random.hh"
 #include "Legendre.hh"
+#include "kernels.hh"
+#include "prof.hh"
 
 #define TEST(VAR) \
   std::cout << tc::cyan << #VAR << tc::reset << " = " << VAR << std::endl;
@@ -41,6 +44,7 @@ double testf2(const double* x, const double* c) { return c[0]*testf(x,c+1); }
 */
 
 int main(int argc, char* argv[]) {
+  const char* isa_name = nullptr;
   const char* ofname;
   long unsigned nevents = 100000;
   unsigned npar = NPAR, nbins = 100;
@@ -67,12 +71,15 @@ int main(int argc, char* argv[]) {
          " 1 - verbose")
         (seed,"--seed",cat('[',seed,']'))
         (use_chi2_pars,"--use-chi2-pars")
+        (isa_name,"--isa","kernels ISA: generic, sse4.2, avx2, avx512\n"
+         "default: $ANGLES_ISA, else the best supported")
         .parse(argc,argv,true)) return 0;
     if (npar>NPAR) throw std::runtime_error("npar > " STR(NPAR));
   } catch (const std::exception& e) {
     cerr << e << endl;
     return 1;
   }
+  cpu::init(isa_name); // logs the kernels ISA at startup
 
   // Output file ====================================================
   TFile fout(ofname,"recreate");
@@ -92,7 +99,9 @@ int main(int argc, char* argv[]) {
 
   std::vector<double> v;
   v.reserve(nevents);
+  auto& t_gen = prof::get("generate");
   for (timed_counter<decltype(nevents)> i(nevents); !!i; ++i) {
+    prof::scope t_(t_gen);
     const auto x = dist(gen);
     v.push_back(x);
     h->Fill(x);
@@ -118,7 +127,8 @@ int main(int argc, char* argv[]) {
   fit2->SetParameter(0,h->Integral(1,h->GetNbinsX()+1));
   for (unsigned i=0; i<npar; ++i)
     fit2->SetParameter(i+1,pars_init[i]);
-  auto result = h->Fit(fit2,"S","",-1.,1.);
+  auto result = prof::timed(prof::get("chi2 fit"),
+    [&]{ return h->Fit(fit2,"S","",-1.,1.); });
   fit2->SetLineColor(3);
   fit2->SetTitle(cat("#chi^{2} = ",result->Chi2()).c_str());
   fit2->SetName("fit-chi2-[test)");
@@ -132,11 +142,10 @@ int main(int argc, char* argv[]) {
   }
 
   info("LogL fit");
-  auto LogL = [=,&v](const double* c){
-    double logl = 0.;
-    for (double x : v)
-      logl += log(Legendre(&x,c));
-    return -2.*logl;
+  auto& t_logl = prof::get("logl");
+  auto LogL = [&v,&t_logl](const double* c){
+    prof::scope t_(t_logl);
+    return kernels::logl(v.data(),nullptr,v.size(),c);
   };
 
   minuit<decltype(LogL)> m(NPAR,LogL);
@@ -160,7 +169,7 @@ int main(int argc, char* argv[]) {
     default: break;
   }
 
-  m.Migrad();
+  prof::timed(prof::get("logl fit"),[&]{ return m.Migrad(); });
   double pars[NPAR], errs[NPAR];
   for (unsigned i=0; i<NPAR; ++i)
     m.GetParameter(i,pars[i],errs[i]);
@@ -168,7 +177,9 @@ int main(int argc, char* argv[]) {
   fit->SetParameters(pars);
   fit->SetParErrors(errs);
   fit->SetLineColor(2);
-  fit->SetTitle(cat("-2LogL = ",LogL(pars)).c_str());
+  fit->SetTitle(cat(
+    std::setprecision(17),std::scientific,
+    "-2LogL = ",LogL(pars)).c_str());
   fit->SetName("fit-logl-[test)");
   fit->Write();
   fit->SetName("fit");
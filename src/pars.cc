@@ -1,7 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
-#include <set>
+#include <algorithm>
 
 #include <TFile.h>
 #include <TH1.h>
@@ -11,6 +11,7 @@
 #include "tc_msg.hh"
 #include "tkey.hh"
 #include "ordered_map.hh"
+#include "fit_results.hh"
 
 #define TEST(var) \
   std::cout << "\033[36m" #var "\033[0m = " << var << std::endl;
@@ -22,24 +23,25 @@ using namespace ivanp;
 
 ordered_map<TF1*> hj_mass_bins;
 
+// per bin histograms have the bin in the name, e.g. "...[250,275)"
+inline bool is_bin(const char* name) { return strchr(name,'['); }
+
 void loop(TDirectory* dir) { // LOOP
-  for (TKey& key : get_keys(dir)) {
-    const TClass* key_class = get_class(key);
-    const char* key_name = key.GetName();
-    if (inherits_from<TH1>(key_class)) { // TH1
-      const char* bin1 = strchr(key_name,'[');
-      const char* bin2 = strchr(bin1+1,')');
-      for (TObject* obj : *key_cast<TH1>(key)->GetListOfFunctions()) {
-        if (!obj->InheritsFrom(TF1::Class())) continue;
-        if (!strstr(obj->GetName(),"-logl")) continue;
-
-        hj_mass_bins[std::string(bin1,bin2-bin1+1)] =
-          static_cast<TF1*>(obj);
-      }
-    } else if (inherits_from<TDirectory>(key_class)) { // DIR
-      loop(key_cast<TDirectory>(key));
+  read_keys<TH1>(dir,is_bin,[](TH1* h, TKey& key){
+    const char* bin1 = strchr(key.GetName(),'[');
+    const char* bin2 = strchr(bin1+1,')');
+    TList* fs = h->GetListOfFunctions();
+    for (TObject* obj : *fs) {
+      if (!obj->InheritsFrom(TF1::Class())) continue;
+      if (!strstr(obj->GetName(),"-logl")) continue;
+
+      fs->Remove(obj); // keep the function, not the histogram
+      hj_mass_bins[std::string(bin1,bin2-bin1+1)] =
+        static_cast<TF1*>(obj);
+      break;
     }
-  }
+    delete h;
+  });
 }
 
 int main(int argc, char* argv[]) {
@@ -60,48 +62,55 @@ int main(int argc, char* argv[]) {
   info("Input file",fin.GetName());
   if (fin.IsZombie()) return 1;
 
-  loop(&fin);
-  if (hj_mass_bins.size()==0) {
-    error("nothing to draw");
-    return 1;
-  } else info("hj_mass bins",hj_mass_bins.size());
-  hj_mass_bins.sort();
+  // the results table if present, else the -logl TF1s
+  std::vector<hj::fit_row> rows = hj::read_fit_results(&fin);
+  std::vector<std::string> names(hj::par_names,hj::par_names+hj::npar_max);
+  if (!rows.empty()) info("Fit results table",rows.size());
+  else {
+    loop(&fin);
+    if (hj_mass_bins.size()==0) {
+      error("nothing to draw");
+      return 1;
+    }
+    TF1* f1 = hj_mass_bins.front().second;
+    names.resize(f1->GetNpar());
+    for (unsigned p=0; p<names.size(); ++p) names[p] = f1->GetParName(p);
+    for (const auto& b : hj_mass_bins) {
+      const auto& str = b.first;
+      const auto d = str.find(',');
+      hj::fit_row row { stod(str.substr(1,d-1)),
+                        stod(str.substr(d+1,str.size()-d-2)) };
+      for (unsigned p=0; p<names.size() && p<hj::npar_max; ++p) {
+        row.pars[p] = b.second->GetParameter(p);
+        row.errs[p] = b.second->GetParError(p);
+      }
+      rows.push_back(row);
+    }
+    std::sort(rows.begin(),rows.end());
+  }
+  info("hj_mass bins",rows.size());
 
   TFile fout(ofname,"recreate");
   info("Output file",fout.GetName());
   if (fout.IsZombie()) return 1;
   fout.cd();
 
-  TF1* f1 = hj_mass_bins.front().second;
-
+  // gaps between bins get empty histogram bins
   std::vector<double> bins;
-  std::set<unsigned> skip;
-  for (const auto& b : hj_mass_bins) {
-    static unsigned i = 1;
-    const auto& str = b.first;
-    const auto d = str.find(',');
-    std::array<double,2> bin {
-      stod(str.substr(1,d-1)),
-      stod(str.substr(d+1,str.size()-d-2))
-    };
-
-    if (bins.empty() || bins.back()!=bin[0]) {
-      if (!bins.empty()) skip.insert(i);
-      bins.push_back(bin[0]);
-    }
-    bins.push_back(bin[1]);
-    ++i;
+  std::vector<unsigned> hbin; // histogram bin of each row
+  for (const auto& row : rows) {
+    if (bins.empty() || bins.back()!=row.lo) bins.push_back(row.lo);
+    bins.push_back(row.hi);
+    hbin.push_back(bins.size()-1);
   }
 
-  for (unsigned p=0, np=f1->GetNpar(); p<np; ++p) {
-    const char* name = f1->GetParName(p);
+  for (unsigned p=0, np=std::min<unsigned>(names.size(),hj::npar_max);
+       p<np; ++p) {
+    const char* name = names[p].c_str();
     TH1D* h = new TH1D(name,name,bins.size()-1,bins.data());
-    unsigned i = 1;
-    for (const auto& b : hj_mass_bins) {
-      if (skip.count(i)) ++i;
-      h->SetBinContent(i,b.second->GetParameter(p));
-      // h.SetBinError(i,b.second->GetParError(p));
-      ++i;
+    for (unsigned i=0; i<rows.size(); ++i) {
+      h->SetBinContent(hbin[i],rows[i].pars[p]);
+      // h->SetBinError(hbin[i],rows[i].errs[p]);
     }
   }
 
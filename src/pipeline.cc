@@ -0,0 +1,360 @@
+// angles → fit → pars → llr in one pass, without intermediate files
+//
+// Config file, one setting per line:
+//   input  events.root ...   events trees, as for angles
+//   output pipeline.root     pars and LLR histograms
+//   mass   12 250 550        Higgs+jet mass binning
+//   mass-edges 250 300 400   or variable mass bin edges
+//   range  0.8               max |cos θ| fit range
+//   npar   3 4               fits to do; LLR is relative to the fewest
+//   init   0 0 0 0           initial parameter values
+//   nbins  50                cos θ bins of the χ² fit
+//   chi2-pars                start LogL fits from χ² fit parameters
+//   angles angles.root       optional: also write the angles tree
+//   fits   fits              optional: also write fits_<npar>.root
+//                            files, readable by draw, pars and llr
+// Each npar directory of the output also has the fit_results table.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <array>
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+
+#include <TFile.h>
+#include <TChain.h>
+#include <TH1.h>
+#include <TF1.h>
+#include <TMath.h>
+
+#include "program_options.hh"
+#include "timed_counter.hh"
+#include "tc_msg.hh"
+#include "binner.hh"
+#include "Legendre.hh"
+#include "kernels.hh"
+#include "hj_fit.hh"
+#include "prof.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::get;
+using namespace ivanp;
+
+struct mass_bin {
+  std::vector<double> x, w; // cos θ and weights in separate arrays
+  mass_bin(): x(), w() { x.reserve(1<<10); w.reserve(1<<10); }
+  inline void operator()(double _x, double _w) {
+    if (std::abs(_x)>1.) return;
+    x.push_back(_x);
+    w.push_back(_w);
+  }
+  inline size_t size() const noexcept { return x.size(); }
+};
+
+struct config {
+  std::vector<std::string> ifnames;
+  std::string ofname, angles_ofname, fits_prefix;
+  std::string tree_name = "events";
+  std::vector<double> mass; // bin edges
+  double range = 1.;
+  std::vector<unsigned> npar;
+  hj::fit_options fit;
+
+  void read(const char* cfname) {
+    std::ifstream f(cfname);
+    if (!f) throw error("cannot open ",cfname);
+    for (std::string str; std::getline(f,str); ) {
+      if (str.empty() || str[0]=='#') continue;
+      std::stringstream ss(str);
+      ss >> str;
+      if (str=="input") {
+        for (std::string name; ss >> name; ) ifnames.push_back(name);
+      }
+      else if (str=="output") ss >> ofname;
+      else if (str=="angles") ss >> angles_ofname;
+      else if (str=="fits") ss >> fits_prefix;
+      else if (str=="tree") ss >> tree_name;
+      else if (str=="mass") {
+        unsigned n = 0;
+        double a = 0, b = 0;
+        ss >> n >> a >> b;
+        mass.clear();
+        for (unsigned i=0; i<=n; ++i) mass.push_back(i<n ? a + (b-a)*i/n : b);
+      }
+      else if (str=="mass-edges") {
+        mass.clear();
+        for (double e; ss >> e; ) mass.push_back(e);
+      }
+      else if (str=="range") ss >> range;
+      else if (str=="npar") {
+        for (unsigned n; ss >> n; ) npar.push_back(n);
+      }
+      else if (str=="init") for (auto& x : fit.init) ss >> x;
+      else if (str=="nbins") ss >> fit.nbins;
+      else if (str=="chi2-pars") fit.use_chi2_pars = true;
+      else throw error("unknown setting ",str);
+      if (ss.fail() && !ss.eof()) throw error("bad value for ",str);
+    }
+    if (ifnames.empty()) throw error("no input files");
+    if (mass.size() < 2) throw error("no mass binning");
+    if (!std::is_sorted(mass.begin(),mass.end()))
+      throw error("mass edges not in increasing order");
+    if (npar.empty()) npar.push_back(hj::npar_max);
+    // LLR of the nested fits is relative to the one with fewest parameters
+    std::sort(npar.begin(),npar.end());
+    npar.erase(std::unique(npar.begin(),npar.end()),npar.end());
+    for (unsigned n : npar)
+      if (n>hj::npar_max) throw error("npar > ",hj::npar_max);
+    if (!(0 < range && range <= 1.)) throw error("range not in (0,1]");
+  }
+};
+
+int main(int argc, char* argv[]) {
+  const char* isa_name = nullptr;
+  const char *cfname, *ofname = nullptr;
+  config cfg;
+
+  try {
+    using namespace ivanp::po;
+    if (program_options()
+      (cfname,'c',"config file",req(),pos())
+      (ofname,'o',"output file, overrides the config")
+      (cfg.fit.print_level,{"-v","--print-level"},
+       "-1 - quiet (also suppress all warnings)\n"
+       " 0 - normal (default)\n"
+       " 1 - verbose",
+       switch_init(1))
+      (isa_name,"--isa","kernels ISA: generic, sse4.2, avx2, avx512\n"
+       "default: $ANGLES_ISA, else the best supported")
+      .parse(argc,argv,true)) return 0;
+
+    try {
+      cfg.read(cfname);
+    } catch (const std::exception& e) {
+      throw error("in ",cfname,": ",e.what());
+    }
+    if (ofname) cfg.ofname = ofname;
+    if (cfg.ofname.empty()) throw error("no output file");
+  } catch (const std::exception& e) {
+    cerr << e << endl;
+    return 1;
+  }
+  cpu::init(isa_name); // logs the kernels ISA at startup
+  const double fit_scale = 1./cfg.range;
+
+  // Input ==========================================================
+  TChain chain(cfg.tree_name.c_str());
+  info("Input files");
+  for (const auto& name : cfg.ifnames) {
+    if (!chain.Add(name.c_str(),0)) return 1;
+    cout << "  " << name << endl;
+  }
+  cout << endl;
+
+  double px[2], py[2], pz[2], E[2], weight = 1.;
+  chain.SetBranchAddress("px",px);
+  chain.SetBranchAddress("py",py);
+  chain.SetBranchAddress("pz",pz);
+  chain.SetBranchAddress("E",E);
+  if (chain.GetBranch("weight")) chain.SetBranchAddress("weight",&weight);
+
+  // Optional angles tree, as from angles with a weight branch
+  std::unique_ptr<TFile> angles_file;
+  TTree *angles_tree = nullptr;
+  double hj_mass, cos_theta;
+  if (!cfg.angles_ofname.empty()) {
+    angles_file.reset(new TFile(cfg.angles_ofname.c_str(),"recreate","",109));
+    info("Angles file",angles_file->GetName());
+    if (angles_file->IsZombie()) return 1;
+    angles_tree = new TTree("angles","");
+    angles_tree->Branch("hj_mass",&hj_mass);
+    angles_tree->Branch("cos_theta",&cos_theta);
+    angles_tree->Branch("weight",&weight);
+  }
+
+  // indexed: variable width bins are found without a binary search
+  binner<mass_bin, std::tuple<
+    axis_spec<indexed_axis<double>, false, false> >
+  > hj_mass_bins(indexed_axis<double>(cfg.mass,4*(cfg.mass.size()-1)));
+  const auto& mass_axis = hj_mass_bins.axis();
+
+  // Event LOOP =====================================================
+  auto& t_read   = prof::get("read");
+  auto& t_angles = prof::get("angles");
+  auto& t_fill   = prof::get("fill");
+
+  constexpr unsigned block = 1<<12;
+  std::array<std::vector<double>,8> p; // Higgs t,x,y,z then jet t,x,y,z
+  const double* pp[8];
+  for (unsigned i=0; i<8; ++i) {
+    p[i].resize(block);
+    pp[i] = p[i].data();
+  }
+  std::vector<double> mass(block), cth(block), wt(block);
+
+  auto process = [&](unsigned n){
+    prof::timed(t_angles,[&]{
+      kernels::cos_theta(pp,n,mass.data(),cth.data()); });
+    prof::scope t_(t_fill);
+    for (unsigned i=0; i<n; ++i) {
+      const double M = mass[i];
+      if (M < mass_axis.min() || mass_axis.max() <= M) continue;
+      if (angles_tree) {
+        hj_mass = M;
+        cos_theta = cth[i];
+        weight = wt[i];
+        angles_tree->Fill();
+      }
+      hj_mass_bins(M, cth[i]*fit_scale, wt[i]);
+    }
+  };
+
+  unsigned n = 0;
+  for (timed_counter<Long64_t> ent(chain.GetEntries()); !!ent; ++ent) {
+    prof::timed(t_read,[&]{ return chain.GetEntry(ent); });
+    for (unsigned i=0; i<2; ++i) {
+      p[4*i  ][n] = E[i];
+      p[4*i+1][n] = px[i];
+      p[4*i+2][n] = py[i];
+      p[4*i+3][n] = pz[i];
+    }
+    wt[n] = weight;
+    if (++n == block) {
+      process(n);
+      n = 0;
+    }
+  }
+  process(n);
+
+  if (angles_file) {
+    angles_file->cd();
+    TNamed("M range",cat('[',mass_axis.min(),',',mass_axis.max(),')').c_str())
+      .Write();
+    info("Saving",angles_file->GetName());
+    angles_file->Write(0,TObject::kOverwrite);
+    angles_file.reset();
+  }
+
+  // Fit in mass bins ===============================================
+  const unsigned nfits = cfg.npar.size(), nbins = mass_axis.nbins();
+  std::vector<std::vector<hj::fit_result>> results(nfits);
+
+  for (unsigned f=0; f<nfits; ++f) {
+    auto opt = cfg.fit;
+    opt.npar = cfg.npar[f];
+    results[f].reserve(nbins);
+    for (unsigned b=1; b<=nbins; ++b) {
+      const auto& bin = hj_mass_bins.bins()[b-1];
+      const std::string hj_mass_bin = hj_mass_bins.bin_str(b);
+      info(cat("Fitting hj_mass ",hj_mass_bin,", npar = ",opt.npar));
+      info("Events",bin.size());
+      results[f].push_back(hj::fit(bin.x.data(),bin.w.data(),bin.size(),
+        opt,cat(opt.npar,' ',hj_mass_bin)));
+      if (results[f].back().status)
+        warning("Migrad status",results[f].back().status);
+    }
+  }
+
+  // Optional fits files, as from fit =================================
+  if (!cfg.fits_prefix.empty()) {
+    prof::scope t_(prof::get("write fits"));
+    for (unsigned f=0; f<nfits; ++f) {
+      TFile fout(cat(cfg.fits_prefix,'_',cfg.npar[f],".root").c_str(),
+                 "recreate");
+      info("Fits file",fout.GetName());
+      if (fout.IsZombie()) return 1;
+      fout.cd();
+      hj::fit_results_writer table;
+
+      for (unsigned b=1; b<=nbins; ++b) {
+        const auto& bin = hj_mass_bins.bins()[b-1];
+        const auto& r = results[f][b-1];
+        const std::string hj_mass_bin = hj_mass_bins.bin_str(b);
+
+        TH1D *h = new TH1D(("cos_theta-hj_mass"+hj_mass_bin).c_str(),
+          ("hj_mass "+hj_mass_bin).c_str(), cfg.fit.nbins, -1., 1.);
+        h->SetXTitle(cat("cos #theta / ",cfg.range).c_str());
+        hj::fill_cos_hist(h,bin.size(),bin.x.data(),bin.w.data());
+
+        // same parameter order as in fit: A first
+        auto opt = cfg.fit;
+        opt.npar = cfg.npar[f];
+        TF1 *fchi2 = hj::chi2_function(opt);
+        fchi2->SetParameter(0,r.chi2_pars[hj::npar_max]);
+        for (unsigned i=0; i<hj::npar_max; ++i)
+          fchi2->SetParameter(i+1,r.chi2_pars[i]);
+        fchi2->SetTitle(cat(
+          std::setprecision(15),std::scientific,
+          "#chi^{2} = ",r.chi2
+        ).c_str());
+
+        TF1 *flogl = new TF1("fit-logl",Legendre,-1.,1.,hj::npar_max);
+        flogl->SetLineColor(2);
+        for (unsigned i=0; i<hj::npar_max; ++i)
+          flogl->SetParName(i,hj::par_names[i]);
+        flogl->SetParameters(r.pars.data());
+        flogl->SetParErrors(r.errs.data());
+        flogl->SetTitle(cat(
+          std::setprecision(17),std::scientific,
+          "-2LogL = ",r.logl).c_str());
+
+        h->GetListOfFunctions()->Add(fchi2);
+        h->GetListOfFunctions()->Add(flogl);
+        h->Write();
+
+        table.fill(r.row(mass_axis.lower(b).get(),mass_axis.upper(b).get(),
+          opt.nfree(),bin.size()));
+      }
+      table.write();
+    }
+  }
+
+  // Output: as from pars and llr ===================================
+  TFile fout(cfg.ofname.c_str(),"recreate");
+  info("Output file",fout.GetName());
+  if (fout.IsZombie()) return 1;
+
+  const double* edges = mass_axis.edges().data();
+
+  for (unsigned f=0; f<nfits; ++f) {
+    fout.mkdir(cat("npar",cfg.npar[f]).c_str())->cd();
+    auto opt = cfg.fit;
+    opt.npar = cfg.npar[f];
+    hj::fit_results_writer table;
+    for (unsigned b=0; b<nbins; ++b)
+      table.fill(results[f][b].row(
+        mass_axis.lower(b+1).get(), mass_axis.upper(b+1).get(),
+        opt.nfree(), hj_mass_bins.bins()[b].size()));
+    for (unsigned p=0; p<hj::npar_max; ++p) {
+      const char* name = hj::par_names[p];
+      TH1D* h = new TH1D(name,name,nbins,edges);
+      for (unsigned b=0; b<nbins; ++b) {
+        h->SetBinContent(b+1,results[f][b].pars[p]);
+        h->SetBinError(b+1,results[f][b].errs[p]);
+      }
+    }
+    TH1D* h = new TH1D("logl","-2LogL",nbins,edges);
+    for (unsigned b=0; b<nbins; ++b)
+      h->SetBinContent(b+1,results[f][b].logl);
+  }
+
+  fout.cd();
+  for (unsigned f=1; f<nfits; ++f) {
+    TH1D* h_llr = new TH1D(cat("LLR",f).c_str(),"#Delta(-2LogL)",nbins,edges);
+    TH1D* h_p = new TH1D(cat("P",f).c_str(),"P-value",nbins,edges);
+    for (unsigned b=0; b<nbins; ++b) {
+      const double llr = results[0][b].logl - results[f][b].logl;
+      h_llr->SetBinContent(b+1,llr);
+      h_p->SetBinContent(b+1,TMath::Prob(llr,1));
+    }
+  }
+
+  info("Saving",fout.GetName());
+  prof::scope t_(prof::get("write"));
+  fout.Write(0,TObject::kOverwrite);
+}